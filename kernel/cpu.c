@@ -0,0 +1,163 @@
+#include "include/defs.h"
+#include "include/types.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/param.h"
+#include "include/cpu.h"
+#include "include/percpu.h"
+
+extern bool probe_cbozero(void *block);
+extern bool probe_zbb(uint64_t x);
+extern bool probe_svinval(uint64_t x);
+extern bool probe_sstc(uint64_t x);
+extern bool probe_menvcfg(uint64_t x);
+
+// features of the hart, filled in as it comes up.
+DEFINE_PER_CPU(uint64_t, cpu_features);
+
+// size in bytes of the block zeroed by cbo.zero,
+// 0 if the harts don't implement Zicboz.
+uint64_t cbozero_size = 0;
+
+// the features the kernel has been patched for. set by the boot
+// hart once the alternatives are applied, the other harts wait for
+// it before they run any code that may have been patched.
+static volatile uint64_t cpu_patched = 0;
+static volatile bool cpu_ready = false;
+
+// probe the optional extensions of the calling hart.
+// runs in machine mode with interrupts off.
+uint64_t _cpuprobe() {
+    uint64_t f = 0;
+
+    // the single-letter extensions are listed in misa.
+    if (r_misa() & MISA_V) {
+        f |= CPU_V;
+    }
+    if (probe_zbb(0)) {
+        f |= CPU_ZBB;
+    }
+    if (probe_svinval(0)) {
+        f |= CPU_SVINVAL;
+    }
+    if (probe_sstc(0)) {
+        f |= CPU_SSTC;
+    }
+    if (probe_menvcfg(0)) {
+        // menvcfg.PBMTE is read-only zero without Svpbmt.
+        s_menvcfg(MENVCFG_PBMTE);
+        if (r_menvcfg() & MENVCFG_PBMTE) {
+            f |= CPU_SVPBMT;
+        }
+        c_menvcfg(MENVCFG_PBMTE);
+    }
+
+    uint8_t *page = pagealloc(1);
+    if (page == NULL) {
+        panic("cpuprobe: no free memory");
+    }
+    // the block size isn't discoverable from a CSR, so fill a page,
+    // zero its first block and count how many bytes went to zero.
+    memset(page, 0xff, PGSIZE);
+    if (probe_cbozero(page)) {
+        uint64_t n = 0;
+        while (n < PGSIZE && page[n] == 0) {
+            n++;
+        }
+        // a block is a power of two that divides the page.
+        if (n >= 8 && (n & (n - 1)) == 0) {
+            f |= CPU_ZICBOZ;
+            cbozero_size = n;
+        }
+    }
+    pagedealloc((struct page*)page);
+
+    return f;
+}
+
+// overwrite the first instructions of orig with a jump to repl:
+//     auipc t1, hi(repl - orig)
+//     jalr  zero, lo(repl - orig)(t1)
+// t1 is caller-saved, so it's free at the entry of a function.
+// the code may be compressed and only 2-byte aligned, hence the
+// halfword stores.
+void _cpupatch(void *orig, void *repl) {
+    int64_t off = (uint64_t)repl - (uint64_t)orig;
+    int64_t hi = (off + 0x800) >> 12;
+    int64_t lo = off - (hi << 12);
+    uint32_t insn[2];
+    insn[0] = ((hi & 0xfffff) << 12) | (6 << 7) | 0x17;
+    insn[1] = ((lo & 0xfff) << 20) | (6 << 15) | 0x67;
+
+    uint16_t *dst = (uint16_t*)orig;
+    uint16_t *src = (uint16_t*)insn;
+    for (int i = 0; i < 4; i++) {
+        dst[i] = src[i];
+    }
+}
+
+// probe the boot hart and patch the kernel for it.
+// runs in machine mode with interrupts off, from kinit(), while the
+// kernel text is still writable (translation is off in machine mode).
+void cpuinit() {
+    uint64_t f = _cpuprobe();
+    this_cpu(cpu_features) = f;
+
+    struct alternative *alt = (struct alternative*)ALT_START;
+    struct alternative *end = (struct alternative*)ALT_END;
+    int n = 0;
+    for (; alt < end; alt++) {
+        if ((alt->feature & f) == alt->feature) {
+            _cpupatch(alt->orig, alt->repl);
+            n++;
+        }
+    }
+    asm volatile("fence.i");
+    cpu_patched = f;
+    __sync_synchronize();
+    cpu_ready = true;
+
+    cpuinithart(0);
+    printf("cpu init... features 0x%x, %d alternatives applied, cbo.zero block %d bytes\n",
+           f, n, cbozero_size);
+}
+
+// per-hart part of the setup, every hart has its own menvcfg and mstatus.
+void cpuinithart(uint64_t hartid) {
+    if (hartid != 0) {
+        // don't run anything that may be patched before the boot hart
+        // is done, then drop whatever stale instructions we fetched.
+        while (!cpu_ready)
+            ;
+        __sync_synchronize();
+        asm volatile("fence.i");
+
+        uint64_t f = _cpuprobe();
+        this_cpu(cpu_features) = f;
+        if ((f & cpu_patched) != cpu_patched) {
+            panic("hart %d lacks features 0x%x the kernel is patched for",
+                  hartid, cpu_patched & ~f);
+        }
+    }
+
+    if (cpu_patched & CPU_ZICBOZ) {
+        // pages are also zeroed from supervisor mode.
+        s_menvcfg(MENVCFG_CBZE);
+    }
+    if (cpu_patched & CPU_V) {
+        // the vector unit is off after reset, the memory routines need it.
+        w_mstatus(r_mstatus() | MSTATUS_VS_INITIAL);
+    }
+    if (cpu_patched & CPU_SSTC) {
+        // the timer is stimecmp, it raises the supervisor timer
+        // interrupt. the CLINT's compare register is never set again,
+        // park it so it doesn't fire as well.
+        s_menvcfg(MENVCFG_STCE);
+        *(uint64_t*)CLINT_MTIMECMP(hartid) = ~0UL;
+    }
+}
+
+// does every hart that is up have all of the features f?
+bool cpu_has(uint64_t f) {
+    return (cpu_patched & f) == f;
+}
@@ -0,0 +1,62 @@
+#include "include/elf.h"
+#include "include/proc.h"
+#include "include/defs.h"
+
+// load an ELF64 executable into the address space of p.
+// nothing is copied or mapped here: every PT_LOAD segment is recorded
+// as a virtual memory area and its pages are brought in by vma_fault()
+// the first time the program touches them. the image itself has to
+// stay in memory and be page-aligned, since read-only pages are mapped
+// straight out of it and so shared by every process running it.
+// return 0 on success, -1 if the image is not something we can run.
+int elf_load(struct proc *p, uint8_t *bin, uint64_t sz) {
+    struct elfhdr *eh = (struct elfhdr*)bin;
+    if (sz < sizeof(struct elfhdr) || eh->magic != ELF_MAGIC) {
+        return -1;
+    }
+    if (eh->elf[0] != ELF_CLASS64 || eh->type != ET_EXEC || eh->machine != EM_RISCV) {
+        return -1;
+    }
+    if (eh->phoff + (uint64_t)eh->phnum * sizeof(struct proghdr) > sz) {
+        return -1;
+    }
+
+    struct proghdr *ph = (struct proghdr*)(bin + eh->phoff);
+    for (int i = 0; i < eh->phnum; i++, ph++) {
+        if (ph->type != ELF_PROG_LOAD || ph->memsz == 0) {
+            continue;
+        }
+        if (ph->memsz < ph->filesz || ph->off + ph->filesz > sz) {
+            return -1;
+        }
+        if (ph->vaddr + ph->memsz < ph->vaddr || ph->vaddr + ph->memsz > MAXVA) {
+            return -1;
+        }
+        // the offset in the file and the virtual address must agree
+        // within a page, otherwise a file page can't back a user page.
+        if ((ph->vaddr & (PGSIZE-1)) != (ph->off & (PGSIZE-1))) {
+            return -1;
+        }
+
+        uint64_t perm = 0;
+        if (ph->flags & ELF_PROG_FLAG_READ) {
+            perm |= PTE_R;
+        }
+        if (ph->flags & ELF_PROG_FLAG_WRITE) {
+            // the MMU has no write-only pages.
+            perm |= PTE_R|PTE_W;
+        }
+        if (ph->flags & ELF_PROG_FLAG_EXEC) {
+            perm |= PTE_X;
+        }
+        if (perm == 0) {
+            return -1;
+        }
+        if (vma_add(p, ph->vaddr, ph->vaddr + ph->memsz, perm, bin + ph->off, ph->filesz) < 0) {
+            return -1;
+        }
+    }
+
+    p->pc = eh->entry;
+    return 0;
+}
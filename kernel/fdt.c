@@ -0,0 +1,190 @@
+#include "include/types.h"
+#include "include/memlayout.h"
+#include "include/param.h"
+#include "include/defs.h"
+
+// the flattened device tree (DTB) qemu hands to hart 0 in a1. it says
+// how much RAM the machine has and which harts there are, so the page
+// allocator, the cpus and the PLIC contexts follow -m and -smp instead
+// of the sizes the kernel was built with.
+//
+// the blob is a header, a block of tokens that describes the tree
+// depth first, and a block of property names. all of it is big-endian
+// and the tokens are aligned to 4 bytes.
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+// qemu's tree is 4 levels deep.
+#define FDT_MAXDEPTH 16
+
+struct fdt_header {
+    uint32_t magic;
+    uint32_t totalsize;
+    uint32_t off_dt_struct;
+    uint32_t off_dt_strings;
+    uint32_t off_mem_rsvmap;
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+};
+
+// the end of the RAM the kernel runs in, and a bit for every hart the
+// tree lists. without a tree, the RAM is the linker script's and
+// hartmask stays 0, the harts up to NCPU are tried and waited for.
+uint64_t phystop;
+uint64_t hartmask;
+
+static uint32_t _be32(const void *p) {
+    return __builtin_bswap32(*(const uint32_t*)p);
+}
+
+// a number n cells (32 bits each) long, most significant cell first.
+static uint64_t _cells(const uint8_t *p, uint32_t n) {
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        v = (v << 32) | _be32(p + 4 * i);
+    }
+    return v;
+}
+
+static uint64_t _strlen(const char *s) {
+    uint64_t n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+static bool _prefix(const char *s, const char *prefix) {
+    while (*prefix) {
+        if (*s++ != *prefix++) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _streq(const char *a, const char *b) {
+    return _prefix(a, b) && a[_strlen(b)] == '\0';
+}
+
+enum fdtnode {
+    NODE_OTHER,
+    NODE_MEMORY,  // /memory@...
+    NODE_CPUS,    // /cpus
+    NODE_CPU,     // /cpus/cpu@...
+};
+
+// read what the kernel needs out of the tree before the page allocator
+// is up: qemu puts the blob near the end of RAM, where it is soon
+// overwritten by the pages handed out.
+void fdtinit(uint64_t dtb) {
+    const struct fdt_header *h = (const struct fdt_header*)dtb;
+    if (dtb == 0 || _be32(&h->magic) != FDT_MAGIC) {
+        phystop = HEAP_START + HEAP_SIZE;
+        printf("fdt: no device tree at 0x%lx, %ld MB of RAM and up to %d harts\n",
+               dtb, (phystop - KERNBASE) >> 20, NCPU);
+        return;
+    }
+    const uint8_t *p = (const uint8_t*)dtb + _be32(&h->off_dt_struct);
+    const uint8_t *end = p + _be32(&h->size_dt_struct);
+    const char *strings = (const char*)dtb + _be32(&h->off_dt_strings);
+
+    // every node's #address-cells and #size-cells, they say how long
+    // the reg properties of its children are. depth 0 is the parent
+    // of the root, depth 1 the root.
+    uint32_t acells[FDT_MAXDEPTH] = {2};
+    uint32_t scells[FDT_MAXDEPTH] = {1};
+    enum fdtnode node[FDT_MAXDEPTH] = {NODE_OTHER};
+    int depth = 0;
+    // the cpu node being read.
+    uint64_t hart = 0;
+    bool okay = true;
+
+    while (p < end) {
+        uint32_t tok = _be32(p);
+        p += 4;
+        if (tok == FDT_END) {
+            break;
+        }
+        switch (tok) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char*)p;
+            p += (_strlen(name) + 1 + 3) & ~3UL;
+            if (++depth == FDT_MAXDEPTH) {
+                panic("fdt: tree deeper than %d", FDT_MAXDEPTH);
+            }
+            acells[depth] = 2;
+            scells[depth] = 1;
+            node[depth] = NODE_OTHER;
+            if (depth == 2 && _prefix(name, "memory")) {
+                node[depth] = NODE_MEMORY;
+            } else if (depth == 2 && _streq(name, "cpus")) {
+                node[depth] = NODE_CPUS;
+            } else if (depth == 3 && node[2] == NODE_CPUS && _prefix(name, "cpu@")) {
+                node[depth] = NODE_CPU;
+                hart = NCPU;
+                okay = true;
+            }
+            break;
+        }
+        case FDT_END_NODE:
+            if (node[depth] == NODE_CPU && okay) {
+                if (hart < NCPU) {
+                    hartmask |= 1UL << hart;
+                } else {
+                    printf("fdt: hart%ld left out, NCPU is %d\n", hart, NCPU);
+                }
+            }
+            depth--;
+            break;
+        case FDT_PROP: {
+            uint32_t len = _be32(p);
+            const char *name = strings + _be32(p + 4);
+            const uint8_t *val = p + 8;
+            p += 8 + ((len + 3) & ~3U);
+
+            if (_streq(name, "#address-cells")) {
+                acells[depth] = _be32(val);
+            } else if (_streq(name, "#size-cells")) {
+                scells[depth] = _be32(val);
+            } else if (node[depth] == NODE_MEMORY && _streq(name, "reg")) {
+                // a list of (base, size), the kernel was loaded into
+                // one of them and uses that one.
+                uint32_t a = acells[depth - 1], s = scells[depth - 1];
+                for (uint32_t off = 0; off + 4 * (a + s) <= len; off += 4 * (a + s)) {
+                    uint64_t base = _cells(val + off, a);
+                    uint64_t size = _cells(val + off + 4 * a, s);
+                    if (base <= KERNBASE && KERNBASE < base + size) {
+                        phystop = base + size;
+                    }
+                }
+            } else if (node[depth] == NODE_CPU && _streq(name, "reg")) {
+                hart = _cells(val, acells[depth - 1]);
+            } else if (node[depth] == NODE_CPU && _streq(name, "status")) {
+                okay = _streq((const char*)val, "okay") || _streq((const char*)val, "ok");
+            }
+            break;
+        }
+        case FDT_NOP:
+            break;
+        default:
+            panic("fdt: bad token %d at 0x%lx", tok, (uint64_t)p - 4);
+        }
+    }
+
+    if (phystop == 0) {
+        phystop = HEAP_START + HEAP_SIZE;
+        printf("fdt: no memory node, %ld MB of RAM assumed\n", (phystop - KERNBASE) >> 20);
+    }
+    if (!(hartmask & 1)) {
+        panic("fdt: hart0 is not in the device tree");
+    }
+    printf("fdt: %ld MB of RAM, harts 0x%lx\n", (phystop - KERNBASE) >> 20, hartmask);
+}
@@ -0,0 +1,34 @@
+#ifndef RVOS_CPU_H
+#define RVOS_CPU_H
+
+#include "types.h"
+
+// optional extensions, probed on every hart at boot by cpu.c.
+#define CPU_V       (1L << 0) // vector
+#define CPU_ZBB     (1L << 1) // basic bit manipulation
+#define CPU_ZICBOZ  (1L << 2) // cache-block zero
+#define CPU_SVPBMT  (1L << 3) // page-based memory types
+#define CPU_SSTC    (1L << 4) // supervisor timer compare
+#define CPU_SVINVAL (1L << 5) // fine-grained TLB invalidation
+
+// an alternative replaces the body of a generic function with a jump to
+// a faster implementation once at boot, when every feature it needs is
+// present. callers keep calling the generic symbol and never branch on
+// the features themselves.
+struct alternative {
+    void *orig;       // generic implementation, patched in place
+    void *repl;       // implementation to run instead
+    uint64_t feature; // CPU_* bits repl needs
+};
+
+// the generic function must not be inlined or specialized by the
+// compiler, or the callers would never reach the patched entry.
+#define PATCHABLE __attribute__((noipa))
+
+// register an alternative, the entries are collected by the linker
+// between _alt_start and _alt_end.
+#define ALTERNATIVE(orig, repl, feat) \
+    static const struct alternative __alt_##repl \
+    __attribute__((used, section(".alternatives"))) = { (void*)(orig), (void*)(repl), (feat) }
+
+#endif //RVOS_CPU_H
@@ -8,12 +8,45 @@ struct page;
 struct alloclist;
 struct trapframe;
 struct spinlock;
+struct proc;
+struct vma;
+struct slab;
+struct pagebatch;
 
 // uart.c
 void uartinit();
 int uartputc(char ch);
 void uartputs(char *s);
 int uartgetc();
+void uartintr();
+void uartflush();
+void uartpanic();
+
+// string.c
+void *memset(void *dst, int c, uint64_t n);
+void *memcpy(void *dst, const void *src, uint64_t n);
+void *memmove(void *dst, const void *src, uint64_t n);
+void *memset_generic(void *dst, int c, uint64_t n);
+void *memcpy_generic(void *dst, const void *src, uint64_t n);
+void *memmove_generic(void *dst, const void *src, uint64_t n);
+
+// vstring.S
+void *memset_rvv(void *dst, int c, uint64_t n);
+void *memcpy_rvv(void *dst, const void *src, uint64_t n);
+void *memmove_rvv(void *dst, const void *src, uint64_t n);
+
+// stringbench.c
+void stringbench();
+
+// bench.c
+void bench(void *arg);
+
+// fdt.c
+extern uint64_t hartmask;
+void fdtinit(uint64_t dtb);
+
+// main.c
+void poweroff(int code);
 
 // printf.c
 int printf(const char *s, ...);
@@ -21,19 +54,56 @@ void panic(const char *s, ...);
 void assert(bool flag);
 
 // page.c
-void pageinit();
+void pageinit(uint64_t end);
 void *pagealloc(int np);
 void *pagezalloc(int np);
+void pagezero(void *pa, int np);
+void pageflush(uint64_t va, uint64_t np, uint64_t asid);
+bool pagezpoolfill();
+void pagezpoolhart(int hart);
+int pagezpoolgethart();
+void *getzeropage();
 void pagedealloc(struct page *p);
+void pagebatchadd(struct pagebatch *b, void *pa);
+void pagedeallocbatch(struct pagebatch *b);
+void pagedefer(struct pagebatch *b);
+bool pagereclaim();
 void printpagealloc();
 void pagemap(pagetable_t pagetable, uint64_t va, uint64_t pa, uint64_t bits, uint64_t level);
-void pageumap(pagetable_t pagetable);
+void pageumap(pagetable_t pagetable, struct pagebatch *b);
 uint64_t va2pa(pagetable_t pagetable, uint64_t vaddr);
+pte_t *pagewalk(pagetable_t pagetable, uint64_t va);
 uint64_t getallocstart();
+uint64_t pagecount();
+
+// slab.c
+void slab_init(struct slab *s, uint64_t size);
+void *slab_alloc(struct slab *s);
+void slab_free(struct slab *s, void *obj);
+
+// cpu.c
+extern uint64_t cbozero_size;
+void cpuinit();
+void cpuinithart(uint64_t hartid);
+bool cpu_has(uint64_t f);
 
 // pagetest.c
 void pagetest();
 
+// irqtrace.c
+void irqtrace_record(int kind, uint64_t start, uint64_t site, uint64_t obj);
+void irqtrace_pushoff(uint64_t site);
+void irqtrace_popoff();
+void irqtrace_trapenter(uint64_t epc, uint64_t cause);
+void irqtrace_trapexit();
+void irqtrace_start();
+void irqtrace_stop();
+
+// trace.c
+void trace_start(uint64_t mask);
+void trace_stop();
+bool trace_running();
+
 // kmem.c
 void kmeminit();
 uint8_t *kmalloc(uint64_t sz);
@@ -47,27 +117,82 @@ uint64_t getnumalloc();
 pagetable_t gettable();
 
 // plic.c
-uint32_t plic_next();
-void plic_complete(uint32_t id);
-void plic_setthreshold(uint8_t tsh);
+uint32_t plic_next(uint64_t hart);
+void plic_complete(uint64_t hart, uint32_t id);
+void plic_setthreshold(uint64_t hart, uint8_t tsh);
 bool plic_ispending(uint32_t id);
-void plic_enable(uint32_t id);
+void plic_enable(uint64_t hart, uint32_t id);
 void plic_setpriority(uint32_t id, uint8_t pri);
 
 // spinlock.c
 void spin_init(struct spinlock *lk);
 void spin_acquire(struct spinlock *lk);
 void spin_release(struct spinlock *lk);
+bool holding(struct spinlock *lk);
+void push_off();
+void pop_off();
 
 // proc.c
 struct cpu* mycpu();
+uint32_t cpuid();
+struct proc* myproc();
 uint64_t proc_init();
-struct proc* proc_alloc(void* fn);
+struct proc* proc_alloc(uint8_t *bin, uint64_t sz);
+struct proc* proc_kthread(void (*fn)(void*), void *arg);
+void proc_exit();
+struct proc* proc_find(uint32_t pid);
+void proc_free(struct proc *p);
+uint64_t proc_rusage(uint32_t pid, uint64_t field);
+void proc_dump();
+bool proc_stackok(struct proc *p);
+bool cpualloc(uint64_t hart);
+void cpufree(uint64_t hart);
+
+// elf.c
+int elf_load(struct proc *p, uint8_t *bin, uint64_t sz);
+
+// vma.c
+int vma_add(struct proc *p, uint64_t start, uint64_t end, uint64_t perm,
+            uint8_t *src, uint64_t filesz);
+struct vma *vma_find(struct proc *p, uint64_t va);
+int vma_fault(struct proc *p, uint64_t va, uint64_t cause);
 
 // syscall.c
 uint64_t do_syscall(uint64_t mepc, struct trapframe *frame);
 
 // sched.c
-bool scheduler(uint64_t *f, uint64_t *m, uint64_t *s);
+void scheduler();
+void schedstart();
+void sched();
+void proc_charge(struct proc *p, bool user);
+void setrunnable(struct proc *p);
+void yield();
+bool preempt();
+void cond_resched();
+void sleep(void *chan, struct spinlock *lk);
+void wakeup(void *chan);
+
+// perf.c
+void perfinithart();
+uint64_t perf_read(uint64_t ev);
+void perf_dump();
+
+// prof.c
+void prof_start(uint64_t hz);
+void prof_stop();
+void prof_dump();
+bool prof_running();
+uint64_t prof_deadline(uint64_t now);
+void prof_tick(uint64_t epc, uint64_t status, struct trapframe *frame);
+
+// tlb.c
+void tlbinithart();
+void tlbpoll();
+void tlbshootdown(uint64_t mask, uint64_t va, uint64_t np, uint64_t asid);
+
+// timer.c
+void timerinit(uint64_t hart);
+void timerintr(uint64_t hart);
+void timersleep(uint64_t until);
 
 #endif //RVOS_DEFS_H
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef RVOS_ELF_H
+#define RVOS_ELF_H
+
+#include "types.h"
+
+// format of an ELF executable file
+
+#define ELF_MAGIC 0x464C457FU  // "\x7FELF" in little endian
+
+#define ELF_CLASS64 2
+#define ET_EXEC 2
+#define EM_RISCV 243
+
+// file header
+struct elfhdr {
+    uint32_t magic;  // must equal ELF_MAGIC
+    uint8_t elf[12];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+// program section header
+struct proghdr {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t off;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+};
+
+// values for proghdr type
+#define ELF_PROG_LOAD 1
+
+// flag bits for proghdr flags
+#define ELF_PROG_FLAG_EXEC 1
+#define ELF_PROG_FLAG_WRITE 2
+#define ELF_PROG_FLAG_READ 4
+
+#endif //RVOS_ELF_H
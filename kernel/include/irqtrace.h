@@ -0,0 +1,26 @@
+#ifndef RVOS_IRQTRACE_H
+#define RVOS_IRQTRACE_H
+
+#include "types.h"
+#include "riscv.h"
+
+// what the irqsoff tracer times, see irqtrace.c.
+enum irqtrace_kind {
+    IRQT_IRQSOFF, // push_off() to pop_off(), interrupts were on before
+    IRQT_TRAP,    // a trap handler, until it returns or switches away
+    IRQT_LOCK,    // a spinlock held
+    IRQT_NKIND,
+};
+
+// offenders a hart keeps of every kind, the longest seen at each site.
+#define IRQT_WORST 8
+
+extern volatile bool irqtrace_on;
+
+// when a section starts, 0 while the tracer is off, so sections
+// that started before it was turned on aren't recorded.
+static inline uint64_t irqtrace_now() {
+    return irqtrace_on ? r_time() : 0;
+}
+
+#endif //RVOS_IRQTRACE_H
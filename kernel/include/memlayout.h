@@ -9,6 +9,7 @@
 // based on qemu's hw/riscv/virt.c:
 //
 // 00001000 -- boot ROM, provided by qemu
+// 00100000 -- test finisher, powers the machine off
 // 02000000 -- CLINT
 // 0C000000 -- PLIC
 // 10000000 -- uart0 
@@ -22,6 +23,17 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// qemu's test finisher (sifive_test), a write to it ends the emulation.
+// qemu exits with 0 on PASS, on FAIL with the code in the upper 16 bits.
+#define VIRT_TEST 0x100000L
+#define VIRT_TEST_PASS 0x5555
+#define VIRT_TEST_FAIL 0x3333
+
+// exit codes for poweroff(), so scripts can tell how a run ended.
+#define EXIT_PASS 0
+#define EXIT_FAIL 1
+#define EXIT_PANIC 2
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -32,8 +44,11 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt pending
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define TIMEBASE 10000000L // mtime ticks per second on qemu virt.
+#define TICK TIMEBASE // mtime ticks between two scheduling rounds.
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -53,9 +68,10 @@
 
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
-// from physical address 0x80000000 to PHYSTOP.
+// from physical address 0x80000000 to PHYSTOP. how much there is
+// comes from the device tree, see fdtinit().
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -89,5 +105,8 @@ extern uint64_t HEAP_START;
 extern uint64_t HEAP_SIZE;
 extern uint64_t KERNEL_STACK_START;
 extern uint64_t KERNEL_STACK_END;
+extern uint64_t ALT_START;
+extern uint64_t ALT_END;
+extern uint64_t phystop;
 
 #endif //RVOS_MEMLAYOUT_H
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef RVOS_PAGE_H
+#define RVOS_PAGE_H
+
+#include "types.h"
+
+// frames on their way back to the page allocator, linked through
+// their first word, so collecting them takes no memory. they can only
+// be freed once no TLB reaches them anymore, and are then freed all
+// at once, under a single acquisition of the allocator's lock.
+struct pagebatch {
+    void *head;
+    void *tail;
+    uint64_t n;
+};
+
+#endif //RVOS_PAGE_H
@@ -1,7 +1,7 @@
 #ifndef RVOS_PARAM_H
 #define RVOS_PARAM_H
 
-#define NCPU 8
-#define NPROC 64
+#define NCPU 8 // highest number of harts, hartids index cpus[]
+#define NVMA 8 // virtual memory areas per process
 
 #endif //RVOS_PARAM_H
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef RVOS_PERCPU_H
+#define RVOS_PERCPU_H
+
+#include "types.h"
+#include "riscv.h"
+
+// every hart has a block of its own for the data only it touches,
+// aligned to cache lines, so harts never share a line through it and
+// updating a per-cpu counter is a plain load and store.
+//
+// the linker collects per-cpu variables into one block in .bss (see
+// kernel.ld), which is hart 0's. the other harts get a block of the
+// same size, and tp always points at the block of the hart it runs on,
+// with struct cpu at its start. like the rest of .bss, per-cpu
+// variables start out zeroed on every hart and can't have initializers.
+
+#define CACHE_LINE 64
+
+extern uint8_t _percpu_start[];
+extern uint8_t _percpu_end[];
+
+#define PERCPU_SIZE ((uint64_t)(_percpu_end - _percpu_start))
+
+#define DEFINE_PER_CPU(type, name) \
+    __attribute__((section(".bss.percpu"))) type name
+// only for struct cpu, which has to be at the start of the block.
+#define DEFINE_PER_CPU_FIRST(type, name) \
+    __attribute__((section(".bss.percpu.first"), aligned(CACHE_LINE))) type name
+#define DECLARE_PER_CPU(type, name) extern type name
+
+// the copy of var in the block at base.
+#define per_cpu_base_ptr(var, base) \
+    ((typeof(&(var)))((uint8_t*)(base) + ((uint8_t*)&(var) - _percpu_start)))
+// this hart's copy of var.
+#define this_cpu_ptr(var) per_cpu_base_ptr(var, r_tp())
+#define this_cpu(var) (*this_cpu_ptr(var))
+// the copy of var that belongs to hart, see cpus[] in proc.h.
+#define per_cpu(var, hart) (*per_cpu_base_ptr(var, cpus[hart]))
+
+#endif //RVOS_PERCPU_H
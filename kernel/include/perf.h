@@ -0,0 +1,43 @@
+#ifndef RVOS_PERF_H
+#define RVOS_PERF_H
+
+#include "types.h"
+#include "percpu.h"
+
+// events the kernel counts itself, per hart. counting is a plain
+// increment of the hart's own copy, the totals are only summed up
+// when somebody asks for them.
+enum perf_sw_event {
+    PERF_TRAP,      // every trap taken
+    // interrupts of every kind, each followed by the cycles it took
+    // from the trap vector to the handler.
+    PERF_SOFTIRQ,
+    PERF_SOFTIRQ_ENTRY,
+    PERF_TIMERIRQ,
+    PERF_TIMERIRQ_ENTRY,
+    PERF_EXTIRQ,
+    PERF_EXTIRQ_ENTRY,
+    PERF_SYSCALL,
+    PERF_PGFAULT,
+    PERF_CTXSW,     // switches from the scheduler to a process
+    PERF_TLBFENCE,  // sfence.vma/sinval.vma issued
+    PERF_PAGEALLOC, // pagealloc()/pagezalloc() calls
+    PERF_PAGEFREE,
+    PERF_SLABALLOC,
+    PERF_UARTDROP,  // console bytes dropped, the ring was full
+    PERF_NSW,
+};
+
+// hardware counters, they can only be read on the hart they count.
+#define PERF_CYCLE 32
+#define PERF_INSTRET 33
+#define PERF_HPM(n) (PERF_CYCLE + (n)) // mhpmcounter3..31, n in [3, 31]
+#define PERF_NEVENTS PERF_HPM(32)
+
+DECLARE_PER_CPU(uint64_t, perf_sw[PERF_NSW]);
+
+static inline void perf_count(enum perf_sw_event ev) {
+    this_cpu(perf_sw)[ev]++;
+}
+
+#endif //RVOS_PERF_H
@@ -1,16 +1,65 @@
+#ifndef RVOS_PROC_H
+#define RVOS_PROC_H
+
 #include "types.h"
 #include "riscv.h"
 #include "trap.h"
 #include "param.h"
 #include "spinlock.h"
+#include "percpu.h"
+#include "rusage.h"
 
 // allocate to pages for stack
 #define STACK_SIZE (8192)
 // adjust the stack to be at the bottom of the memory allocation
 // regardless of where it is on the kernel heap.
 #define STACK_ADDR (0x100000000)
-// all processes will have a defined starting point in virtual memory
-#define STARTING (0x80000000)
+// all processes will have a defined starting point in virtual memory.
+// user programs are linked here (see user/user.ld), one gigapage below
+// the kernel at 0x80000000 so the two never share a top-level entry.
+#define STARTING (0x40000000)
+// every process has a kernel stack of its own, its traps are handled
+// there and it keeps its kernel context there while switched out.
+#define KSTACK_SIZE (2*PGSIZE)
+// a kernel thread is still on its kernel stack when it traps, its
+// traps get a page of their own below it.
+#define KTRAPSTACK_SIZE PGSIZE
+// machine mode doesn't translate, there's no guard page to fault on
+// below a stack. the word at its bottom holds this until something
+// runs over it, sched() checks.
+#define STACK_CANARY 0x57ac4ca9a7157ac4UL
+
+// a virtual memory area is a contiguous range of user addresses with
+// the same permissions. pages inside it are populated lazily on the
+// first page fault, either from the bytes of the program image (src,
+// filesz) or with zeroes for the rest of the range.
+struct vma {
+    uint64_t start;   // first virtual address, not necessarily page-aligned
+    uint64_t end;     // one beyond the last virtual address, 0 if unused
+    uint64_t perm;    // PTE_R|PTE_W|PTE_X, PTE_U is added when mapping
+    uint8_t *src;     // image bytes backing start, NULL for anonymous memory
+    uint64_t filesz;  // number of bytes of src that back the range
+};
+
+// saved registers for kernel context switches
+struct context {
+    uint64_t ra;
+    uint64_t sp;
+
+    // callee-saved
+    uint64_t s0;
+    uint64_t s1;
+    uint64_t s2;
+    uint64_t s3;
+    uint64_t s4;
+    uint64_t s5;
+    uint64_t s6;
+    uint64_t s7;
+    uint64_t s8;
+    uint64_t s9;
+    uint64_t s10;
+    uint64_t s11;
+};
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
@@ -22,8 +71,8 @@ struct procdata {
 };
 
 // the process contains a stack, which gives sp register.
-// the stack shows the top of the stack, so need to add the
-// PGSIZE, because stack grows from high -> low.
+// the stack is an anonymous area of STACK_SIZE bytes at STACK_ADDR,
+// sp starts at its top, because stack grows from high -> low.
 // pc contain the address of the instruction to be executed next.
 // get through mepc register (Machine Exception Program Counter)
 // when interrupt out process either with context-switch timer or
@@ -35,41 +84,50 @@ struct proc {
     struct spinlock lock;
 
     struct trapframe *frame;
-    uint8_t *stack;
+    struct context context; // swtch() here to run the process
+    uint8_t *kstack;        // bottom of the kernel stack
+    void *chan;             // if SLEEPING, what it waits for
+    struct proc *wqnext;    // next on the same wait queue
+    struct proc *tnext;     // next in a timed sleep, see timer.c
+    struct proc *pidnext;   // next with the same pid hash
+    struct proc *rqnext;    // next on the run queue, see sched.c
     uint64_t pc;
-    uint16_t pid;
-    pagetable_t pgt;
+    uint32_t pid;
+    pagetable_t pgt;        // NULL for kernel threads
+    uint64_t cpumask;       // harts that may have pgt's entries cached, bit per hartid
     enum procstate state;
     struct procdata data;
-    uint64_t sleep_until;
+    uint64_t sleep_until;   // mtime to wake up at, 0 if not in a timed sleep
+    struct vma vmas[NVMA];
+    // usage so far, indexed by enum rusage_field. times are in mtime
+    // ticks, up to rustamp, when they were last brought up to date.
+    uint64_t ru[RU_NFIELDS];
+    uint64_t rustamp;
 };
 
-// saved registers for kernel context switches
-struct context {
-    uint64_t ra;
-    uint64_t sp;
-
-    // callee-saved
-    uint64_t s0;
-    uint64_t s1;
-    uint64_t s2;
-    uint64_t s3;
-    uint64_t s4;
-    uint64_t s5;
-    uint64_t s6;
-    uint64_t s7;
-    uint64_t s8;
-    uint64_t s9;
-    uint64_t s10;
-    uint64_t s11;
-};
-
-// per-cpu state
+// per-cpu state, at the start of the hart's per-cpu block,
+// so tp points to it.
 struct cpu {
+    uint64_t hartid;
     struct proc *proc; // the process running on this cpu
     struct context context; // swtch() here to enter scheduler()
-    int noff; // depth of push_off() nesting
+    struct trapframe frame; // the hart's own, for traps while idle
+    bool online; // got through its initialization
+    bool mmode; // runs in machine mode for good, since schedstart()
+    // the depth of push_off() nesting is also the preempt count, the
+    // hart doesn't switch to another process while it's not 0.
+    int noff;
     int intena; // were interrupts enabled before push_off()
+    bool resched; // the timer asked for a switch, see preempt()
 };
 
-extern struct cpu cpus[NCPU];
+// indexed by hartid, NULL for harts that don't exist.
+extern struct cpu *cpus[NCPU];
+
+// the address space identifier of a process. satp only has 16 bits
+// for it, pids are handed out so that no two live processes share
+// one, and 0 is the kernel's. a hart keeps a process's TLB entries
+// when it switches away, changes to them are shot down (tlb.c).
+#define ASID(p) ((p)->pid & 0xffff)
+
+#endif //RVOS_PROC_H
@@ -0,0 +1,24 @@
+#ifndef RVOS_PROF_H
+#define RVOS_PROF_H
+
+#include "types.h"
+#include "riscv.h"
+
+// one sample of the sampling profiler: where the hart was when the
+// timer interrupted it and, for kernel code, the return addresses
+// found by walking the frame pointers. pc[0] is the interrupted pc.
+#define PROF_DEPTH 15
+struct profsample {
+    uint8_t mode;   // privilege mode that was interrupted, 0 U, 1 S, 3 M
+    uint8_t depth;  // valid entries in pc
+    uint8_t pad[6];
+    uint64_t pc[PROF_DEPTH];
+};
+
+// samples a hart keeps, the oldest ones are overwritten.
+#define PROF_RING_PAGES 16
+#define PROF_RING_SIZE (PROF_RING_PAGES * PGSIZE / sizeof(struct profsample))
+
+#define PROF_HZ 1000 // default sampling rate
+
+#endif //RVOS_PROF_H
@@ -19,6 +19,8 @@ r_mhartid()
 #define MSTATUS_MPP_S (1L << 11)
 #define MSTATUS_MPP_U (0L << 11)
 #define MSTATUS_MIE (1L << 3)    // machine-mode interrupt enable.
+#define MSTATUS_VS_MASK (3L << 9) // vector unit state.
+#define MSTATUS_VS_INITIAL (1L << 9)
 
 static inline uint64_t
 r_mstatus()
@@ -34,6 +36,17 @@ w_mstatus(uint64_t x)
   asm volatile("csrw mstatus, %0" : : "r" (x));
 }
 
+// Machine ISA Register, one bit per single-letter extension.
+#define MISA_V (1L << ('V' - 'A'))
+
+static inline uint64_t
+r_misa()
+{
+  uint64_t x;
+  asm volatile("csrr %0, misa" : "=r" (x) );
+  return x;
+}
+
 // machine exception program counter, holds the
 // instruction address to which a return from
 // exception will go.
@@ -43,6 +56,14 @@ w_mepc(uint64_t x)
   asm volatile("csrw mepc, %0" : : "r" (x));
 }
 
+static inline uint64_t
+r_mepc()
+{
+  uint64_t x;
+  asm volatile("csrr %0, mepc" : "=r" (x) );
+  return x;
+}
+
 // Supervisor Status Register, sstatus
 
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
@@ -101,7 +122,19 @@ w_sie(uint64_t x)
 // Machine-mode Interrupt Enable
 #define MIE_MEIE (1L << 11) // external
 #define MIE_MTIE (1L << 7)  // timer
+#define MIE_STIE (1L << 5)  // supervisor timer, driven by stimecmp
 #define MIE_MSIE (1L << 3)  // software
+// Machine-mode Interrupt Pending
+#define MIP_MTIP (1L << 7)
+#define MIP_STIP (1L << 5)
+static inline uint64_t
+r_mip()
+{
+  uint64_t x;
+  asm volatile("csrr %0, mip" : "=r" (x) );
+  return x;
+}
+
 static inline uint64_t
 r_mie()
 {
@@ -186,6 +219,40 @@ w_mtvec(uint64_t x)
   asm volatile("csrw mtvec, %0" : : "r" (x));
 }
 
+// Machine Environment Configuration Register (priv spec 1.12)
+// older assemblers don't know the name, so use the CSR number.
+#define MENVCFG_CBZE (1L << 7)   // allow cbo.zero below machine mode
+#define MENVCFG_PBMTE (1L << 62) // enable Svpbmt page-based memory types
+#define MENVCFG_STCE (1L << 63)  // enable Sstc stimecmp
+
+static inline uint64_t
+r_menvcfg()
+{
+  uint64_t x;
+  asm volatile("csrr %0, 0x30a" : "=r" (x) );
+  return x;
+}
+
+static inline void
+s_menvcfg(uint64_t x)
+{
+  asm volatile("csrs 0x30a, %0" : : "r" (x));
+}
+
+static inline void
+c_menvcfg(uint64_t x)
+{
+  asm volatile("csrc 0x30a, %0" : : "r" (x));
+}
+
+// Supervisor Timer Compare (Sstc), the supervisor timer interrupt is
+// pending while time >= stimecmp. by number, like menvcfg.
+static inline void
+w_stimecmp(uint64_t x)
+{
+  asm volatile("csrw 0x14d, %0" : : "r" (x));
+}
+
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
@@ -260,6 +327,36 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable, which counters user mode may read
+static inline void
+w_scounteren(uint64_t x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+// Machine Counter-Inhibit, a set bit stops the counter (csr 0x320)
+static inline void
+w_mcountinhibit(uint64_t x)
+{
+  asm volatile("csrw 0x320, %0" : : "r" (x));
+}
+
+static inline uint64_t
+r_mcycle()
+{
+  uint64_t x;
+  asm volatile("csrr %0, mcycle" : "=r" (x) );
+  return x;
+}
+
+static inline uint64_t
+r_minstret()
+{
+  uint64_t x;
+  asm volatile("csrr %0, minstret" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64_t
 r_time()
@@ -300,7 +397,7 @@ r_sp()
 }
 
 // read and write tp, the thread pointer, which holds
-// this core's hartid (core number), the index into cpus[].
+// this core's per-cpu block (see percpu.h).
 static inline uint64_t
 r_tp()
 {
@@ -342,6 +439,21 @@ satp_fence_asid(uint64_t x)
 	asm volatile("sfence.vma zero, %0" : : "r" (x) );
 }
 
+// flush the TLB entries of a single page in one address space.
+static inline void
+sfence_vma_page(uint64_t va, uint64_t asid)
+{
+	asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid) );
+}
+
+// zero the cache block containing addr (Zicboz cbo.zero).
+// encoded by hand, older assemblers don't know the mnemonic.
+static inline void
+cbo_zero(void *addr)
+{
+	asm volatile(".insn i 0x0f, 2, x0, %0, 4" : : "r" (addr) : "memory");
+}
+
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
 
@@ -354,6 +466,11 @@ satp_fence_asid(uint64_t x)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4)
 
+// RSW bit, ignored by the MMU. set on leaves that point at a frame the
+// page table does not own (e.g. a shared read-only program page), so
+// tearing down the table must not free it.
+#define PTE_SHARED (1L << 8)
+
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64_t)pa) >> 12) << 10)
 
@@ -0,0 +1,19 @@
+#ifndef RVOS_RUSAGE_H
+#define RVOS_RUSAGE_H
+
+#include "types.h"
+
+// what a process has used, kept in its struct proc and read with the
+// getrusage() syscall. user programs include this as well.
+enum rusage_field {
+    RU_UTIME,  // ns in user mode
+    RU_STIME,  // ns in the kernel, for the process
+    RU_RSS,    // user pages mapped, not counting the shared zero page
+    RU_MAXRSS, // the most user pages it ever had mapped
+    RU_NVCSW,  // switches away because it yielded or slept
+    RU_NIVCSW, // switches away because it was preempted
+    RU_NFAULT, // page faults
+    RU_NFIELDS,
+};
+
+#endif //RVOS_RUSAGE_H
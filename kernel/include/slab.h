@@ -0,0 +1,20 @@
+#ifndef RVOS_SLAB_H
+#define RVOS_SLAB_H
+
+#include "types.h"
+#include "spinlock.h"
+
+// a cache of equally sized kernel objects, carved out of whole pages
+// as they are needed. freed objects go on a free list and are handed
+// out again before a new page is taken.
+struct slab {
+    struct spinlock lock;
+    uint64_t size;      // object size, rounded up to SLAB_ALIGN
+    void *free;         // free objects, linked through their first word
+    uint64_t npages;    // pages taken so far
+    uint64_t nused;     // objects handed out
+};
+
+#define SLAB_ALIGN 16
+
+#endif //RVOS_SLAB_H
@@ -6,6 +6,9 @@
 struct spinlock {
     bool locked;    
     struct cpu *cpu;
+    // for the irqsoff tracer: when the lock was taken, and by whom.
+    uint64_t tstart;
+    uint64_t site;
 };
 
 #endif // RVOS_SPINLOCK_H
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef RVOS_TRACE_H
+#define RVOS_TRACE_H
+
+#include "types.h"
+#include "riscv.h"
+
+// the static tracepoints, see trace.c. tools/tracedump.py has the
+// same list, keep them in step.
+enum trace_event {
+    TR_SCHEDIN,   // a0 pid the scheduler switches to
+    TR_SCHEDOUT,  // a0 pid that switched back, a1 its state
+    TR_TRAP,      // a0 mcause number, bit 31 for interrupts, a1 mepc, a2 mtval
+    TR_SYSCALL,   // a0 syscall number, a1 pid, a2 its first argument
+    TR_PAGEALLOC, // a0 pages, a1 their address, 0 if there were none
+    TR_PAGEFREE,  // a1 address
+    TR_PLIC,      // a0 interrupt id claimed, a1 hart
+    TR_NEVENTS,
+};
+
+// one record, the same size for every event so the rings can be
+// dumped and read back as they are.
+struct tracerec {
+    uint64_t time;  // mtime
+    uint32_t event;
+    uint32_t a0;
+    uint64_t a1;
+    uint64_t a2;
+};
+
+// records a hart keeps, the oldest ones are overwritten.
+#define TRACE_RING_PAGES 16
+#define TRACE_RING_SIZE (TRACE_RING_PAGES * PGSIZE / sizeof(struct tracerec))
+
+// a bit for every event that is recorded, 0 while tracing is off.
+extern volatile uint64_t trace_mask;
+
+void trace_emit(enum trace_event ev, uint64_t a0, uint64_t a1, uint64_t a2);
+
+// a tracepoint. while its event is off, it's a load and a branch.
+static inline void trace(enum trace_event ev, uint64_t a0, uint64_t a1, uint64_t a2) {
+    if (__builtin_expect(trace_mask & (1UL << ev), 0)) {
+        trace_emit(ev, a0, a1, a2);
+    }
+}
+
+#endif //RVOS_TRACE_H
@@ -15,6 +15,8 @@ struct trapframe {
     uint64_t satp;          // 512-519
     uint8_t  *trapstack;    // 520
     uint64_t hartid;        // 528
+    struct cpu *cpu;        // 536, the per-cpu block of that hart, loaded into tp
+    uint64_t entry;         // 544, mcycle when the trap vector was entered
 };
 
 #endif //RVOS_TRAP_H
\ No newline at end of file
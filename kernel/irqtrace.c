@@ -0,0 +1,132 @@
+#include "include/types.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/defs.h"
+#include "include/param.h"
+#include "include/proc.h"
+#include "include/irqtrace.h"
+
+// the irqsoff tracer. while it runs, every stretch of time a hart
+// spends with interrupts off, in a trap handler or holding a spinlock
+// is timed with the time CSR, and the longest ones are kept per hart,
+// one per call site. irqtrace_stop() prints them on the console:
+//   irqsoff <hart> <kind> <ns> <site> <lock or cause>
+// the sites are return addresses, look them up in kernel/kernel.sym
+// or with addr2line -e kernel/kernel.
+
+volatile bool irqtrace_on;
+
+struct irqworst {
+    uint64_t len;  // mtime ticks
+    uint64_t site; // the caller of push_off()/spin_acquire(), or the trapped pc
+    uint64_t obj;  // the lock, or the trap's mcause
+};
+
+struct irqtrace {
+    struct irqworst worst[IRQT_NKIND][IRQT_WORST];
+    // the sections in progress, interrupts off and a trap.
+    uint64_t offstart;
+    uint64_t offsite;
+    uint64_t trapstart;
+    uint64_t trapsite;
+    uint64_t trapcause;
+};
+
+DEFINE_PER_CPU(struct irqtrace, irqtrace);
+
+static const char *irqtrace_names[IRQT_NKIND] = {
+    [IRQT_IRQSOFF] = "irqsoff",
+    [IRQT_TRAP]    = "trap",
+    [IRQT_LOCK]    = "lock",
+};
+
+// a section of kind that started at start is over. it replaces the
+// entry of the same site if it's longer, or else the shortest one.
+// traps are told apart by their cause, they come from anywhere.
+void irqtrace_record(int kind, uint64_t start, uint64_t site, uint64_t obj) {
+    if (start == 0 || !irqtrace_on) {
+        return;
+    }
+    uint64_t len = r_time() - start;
+    struct irqworst *w = this_cpu(irqtrace).worst[kind];
+    struct irqworst *min = &w[0];
+    for (int i = 0; i < IRQT_WORST; i++) {
+        bool same = kind == IRQT_TRAP ? w[i].obj == obj : w[i].site == site;
+        if (w[i].len != 0 && same) {
+            min = &w[i];
+            break;
+        }
+        if (w[i].len < min->len) {
+            min = &w[i];
+        }
+    }
+    if (len > min->len) {
+        min->len = len;
+        min->site = site;
+        min->obj = obj;
+    }
+}
+
+// push_off() turned interrupts off, pop_off() turns them on again.
+void irqtrace_pushoff(uint64_t site) {
+    struct irqtrace *t = this_cpu_ptr(irqtrace);
+    t->offstart = irqtrace_now();
+    t->offsite = site;
+}
+
+void irqtrace_popoff() {
+    struct irqtrace *t = this_cpu_ptr(irqtrace);
+    irqtrace_record(IRQT_IRQSOFF, t->offstart, t->offsite, 0);
+    t->offstart = 0;
+}
+
+// a trap handler starts, and ends by returning or by switching to
+// another process. the time the process is away isn't the handler's.
+void irqtrace_trapenter(uint64_t epc, uint64_t cause) {
+    struct irqtrace *t = this_cpu_ptr(irqtrace);
+    t->trapstart = irqtrace_now();
+    t->trapsite = epc;
+    t->trapcause = cause;
+}
+
+void irqtrace_trapexit() {
+    struct irqtrace *t = this_cpu_ptr(irqtrace);
+    irqtrace_record(IRQT_TRAP, t->trapstart, t->trapsite, t->trapcause);
+    t->trapstart = 0;
+}
+
+void irqtrace_start() {
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] != NULL) {
+            memset(&per_cpu(irqtrace, hart), 0, sizeof(struct irqtrace));
+        }
+    }
+    __sync_synchronize();
+    irqtrace_on = true;
+    printf("irqtrace: on\n");
+}
+
+// stop tracing and print the worst offenders of every hart.
+void irqtrace_stop() {
+    irqtrace_on = false;
+    __sync_synchronize();
+
+    printf("irqsoff-begin\n");
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] == NULL) {
+            continue;
+        }
+        struct irqtrace *t = &per_cpu(irqtrace, hart);
+        for (int kind = 0; kind < IRQT_NKIND; kind++) {
+            for (int i = 0; i < IRQT_WORST; i++) {
+                struct irqworst *w = &t->worst[kind][i];
+                if (w->len == 0) {
+                    continue;
+                }
+                printf("irqsoff %d %s %ld %lx %lx\n", hart, irqtrace_names[kind],
+                       w->len * 1000000000L / TIMEBASE, w->site, w->obj);
+            }
+        }
+    }
+    printf("irqsoff-end\n");
+}
@@ -75,7 +75,7 @@ void kmeminit() {
 // allocate sub-page level allocation based on bytes
 uint8_t *kmalloc(uint64_t sz) {
     uint64_t o = (1 << 3) - 1;
-    sz = (sz + o) & !o;
+    sz = (sz + o) & ~o;
     uint64_t size = sz + sizeof(alloclist);
     alloclist* head = KMEM_HEAD;
     alloclist* tail = (alloclist*)((uint8_t*)KMEM_HEAD + (KMEM_ALLOC * PGSIZE));
@@ -110,12 +110,10 @@ uint8_t *kmalloc(uint64_t sz) {
 // allocate sub-page level allocation based on bytes and zero the memory
 uint8_t *kzmalloc(uint64_t sz) {
     uint64_t o = (1 << 3) - 1;
-    sz = (sz + o) & !o;
+    sz = (sz + o) & ~o;
     uint8_t *ret = kmalloc(sz);
     if (ret != NULL) {
-        for (int i = 0; i < sz; i++) {
-            ret[i] = 0;
-        }
+        memset(ret, 0, sz);
     }
     return ret;
 }
@@ -153,7 +151,10 @@ void coalesce() {
         } else if (_alisfree(head) && _alisfree(next)) {
             // this mean we have adjacent blocks needing to be freed. so we combine 
             // into one allocation
-            _alsetsize(head, (_algetsize(head), _algetsize(next)));
+            _alsetsize(head, _algetsize(head) + _algetsize(next));
+            // the chunk after next may be free as well, look again
+            // before moving on.
+            continue;
         }
         // if get here, recalculate new head
         head = (alloclist*)((uint8_t*)head + _algetsize(head));
@@ -179,5 +180,6 @@ void maprange(pagetable_t pagetable, uint64_t start, uint64_t end, uint64_t bits
     for (int i = 0; i < np; i++) {
         pagemap(pagetable, pa, pa, bits, 0);
         pa += PGSIZE;
+        cond_resched();
     }
 }
@@ -2,21 +2,144 @@
 #include "include/memlayout.h"
 #include "include/riscv.h"
 #include "include/trap.h"
+#include "include/param.h"
+#include "include/proc.h"
 
 static uint64_t KERNEL_TABLE;
-static struct trapframe trapframes[8];
 
-extern void switch_to_user(uint64_t frame, uint64_t mepc, uint64_t satp);
+// the number of harts that finished their own initialization, and
+// the number found online when the boot hart stopped waiting.
+static volatile uint64_t harts_online;
+static volatile uint64_t nharts;
+// mtime when hart 0 released the other harts.
+static uint64_t boot_start;
+
+// how long hart 0 waits for the other harts to check in. without a
+// device tree NCPU is only an upper bound, harts the machine doesn't
+// have never show up, and a hart the tree lists may be broken.
+#define BOOT_TIMEOUT (TIMEBASE / 10)
+
+// a bit for every hart that got in to use its cpu, and BOOT_CLOSED
+// once hart 0 stopped waiting. a hart either gets in before the door
+// closes and is waited for, or stays out and hart 0 frees its cpu,
+// never both.
+#define BOOT_CLOSED (1UL << 63)
+static volatile uint64_t boot_joined;
+
+// the harts to release, the ones in the device tree, or all of them
+// up to NCPU without it.
+static uint64_t _bootharts() {
+    return hartmask ? hartmask : (1UL << NCPU) - 1;
+}
+
+// the part of the initialization that each hart does for itself,
+// in parallel with the others: its trap frame and trap stack,
+// the MMU, its timer and its PLIC context. runs in machine mode.
+static void _kinithart(uint64_t hartid) {
+    struct trapframe *frame = &cpus[hartid]->frame;
+    frame->cpu = cpus[hartid];
+
+    // traps are taken with mscratch pointing at the hart's trap frame,
+    // the kernel's table is moved back and forth between it and the
+    // user applications' tables.
+    frame->hartid = hartid;
+    frame->satp = build_satp(8, 0, KERNEL_TABLE);
+    // the trap handler runs on its own stack on every hart, it is only
+    // used in machine mode, so it doesn't need to be mapped. the stack
+    // is decrement-before push, so start at the top of the page.
+    uint8_t *stack = pagezalloc(1);
+    if (stack == NULL) {
+        panic("hart%d: no trap stack", hartid);
+    }
+    frame->trapstack = stack + PGSIZE;
+    w_mscratch((uint64_t)frame);
+    // copy the same mscratch over to the supervisor version of
+    // the same register
+    w_sscratch(r_mscratch());
+
+    w_satp(frame->satp);
+    satp_fence_asid(0);
+
+    // lower the threshold wall so all interrupts can jump over it,
+    // and let the UART interrupt this hart.
+    plic_setthreshold(hartid, 0);
+    plic_enable(hartid, 10);
+
+    timerinit(hartid);
+    perfinithart();
+    tlbinithart();
+    cpus[hartid]->online = true;
+}
+
+// a released hart asks to come in, false if it's too late.
+static bool _kjoin(uint64_t hartid) {
+    while (1) {
+        uint64_t old = boot_joined;
+        if (old & BOOT_CLOSED) {
+            return false;
+        }
+        if (__sync_bool_compare_and_swap(&boot_joined, old, old | (1UL << hartid))) {
+            return true;
+        }
+    }
+}
+
+// wait for all harts to get through _kinithart() before any of them
+// goes on to kmain().
+static void _kbarrier(uint64_t hartid) {
+    __sync_fetch_and_add(&harts_online, 1);
+    if (hartid != 0) {
+        while (nharts == 0)
+            ;
+        return;
+    }
+    uint64_t expect = __builtin_popcountl(_bootharts());
+    while (harts_online < expect && r_time() - boot_start < BOOT_TIMEOUT)
+        ;
+    // harts that got in just before the door closed are on their way.
+    uint64_t joined = (__sync_fetch_and_or(&boot_joined, BOOT_CLOSED) & ~BOOT_CLOSED) | 1;
+    while (harts_online < __builtin_popcountl(joined))
+        ;
+    __sync_synchronize();
+    nharts = harts_online;
+    printf("%d harts online in %d us\n", nharts,
+           (r_time() - boot_start) * 1000000 / TIMEBASE);
+    if (hartmask & ~joined) {
+        printf("harts 0x%lx are listed but didn't come up\n", hartmask & ~joined);
+    }
+    // from now on the mask is the harts that are up.
+    hartmask = joined;
+
+    // the cpus of harts that didn't show up are given back.
+    uint64_t last = 0;
+    for (uint64_t hart = 1; hart < NCPU; hart++) {
+        if (cpus[hart] == NULL) {
+            continue;
+        }
+        if (!(joined & (1UL << hart))) {
+            cpufree(hart);
+        } else {
+            last = hart;
+        }
+    }
+
+    // the last hart keeps the pool of pre-zeroed pages topped up,
+    // poke it once to fill it for the first time.
+    pagezpoolhart(last);
+    WREG(CLINT_MSIP(last), 1);
+}
 
 //////////////////////////////////
 // ENTRY POINT
 //////////////////////////////////
-void kinit() {
+void kinit(uint64_t dtb) {
+    // entry.S pointed tp to our per-cpu block already, mycpu() and
+    // the spinlocks rely on it.
     uartinit();
-    pageinit();
+    fdtinit(dtb);
+    pageinit(PHYSTOP);
+    cpuinit();
     kmeminit();
-    uint64_t addr = proc_init();
-    printf("init process created at address 0x%x\n", addr);
 
     //printpages();
 
@@ -37,8 +160,7 @@ void kinit() {
     maprange(kpagetable, head, head + (npages) * 4096, PTE_R|PTE_W);
 
     // map heap descriptor
-    uint64_t num_pages = HEAP_SIZE / PGSIZE;
-    maprange(kpagetable, HEAP_START, HEAP_START + num_pages, PTE_R|PTE_W);
+    maprange(kpagetable, HEAP_START, getallocstart(), PTE_R|PTE_W);
 
     // map executable section
     maprange(kpagetable, TEXT_START, TEXT_END, PTE_R|PTE_X);
@@ -63,15 +185,20 @@ void kinit() {
     // CLINT
     pagemap(kpagetable, CLINT, CLINT, PTE_R|PTE_W, 0);
 
+    // test finisher, panic() and poweroff() may run in supervisor mode
+    pagemap(kpagetable, VIRT_TEST, VIRT_TEST, PTE_R|PTE_W, 0);
+
     // MTIMECMP
     pagemap(kpagetable, CLINT_MTIMECMP(0), CLINT_MTIMECMP(0), PTE_R|PTE_W, 0);
 
     // MTIME
     pagemap(kpagetable, CLINT_MTIME, CLINT_MTIME, PTE_R|PTE_W, 0);
 
-    // PLIC
-    maprange(kpagetable, PLIC, 0xc002001, PTE_R|PTE_W);
-    maprange(kpagetable, 0xc200000, 0xc208001, PTE_R|PTE_W);
+    // PLIC, the priorities and pending bits, then the enable bits and
+    // the threshold and claim registers of every hart's two contexts.
+    uint64_t lasthart = 63 - __builtin_clzl(_bootharts());
+    maprange(kpagetable, PLIC, PLIC_SENABLE(lasthart) + 0x80, PTE_R|PTE_W);
+    maprange(kpagetable, PLIC_MPRIORITY(0), PLIC_SPRIORITY(lasthart) + 8, PTE_R|PTE_W);
 
     // the following shows how to walk to tanslate a virtual
     // address into a physical address, use this whenever a
@@ -92,24 +219,15 @@ void kinit() {
     // 9 for Sv48
     KERNEL_TABLE = (uint64_t)kpagetable;
 
-    uint64_t satp_val = build_satp(8, 0, KERNEL_TABLE);
-
-    // have to store kernel's table, the tables will be moved back
-    // adn forth between kernel's table and user applications' table
-    w_mscratch((uint64_t)&trapframes[0]);
-    w_sscratch(r_mscratch());
-    trapframes[0].satp = satp_val;
-
-    // move the stack pointer to the very bottom. the stack is
-    // actually in a non-mapped page. the stack is decrement-before
-    // push and increment after pop. therefore, the stack will be 
-    // allocated before it is stored.
-    trapframes[0].trapstack = (uint8_t*)((uint64_t)pagezalloc(1) + PGSIZE);
-    maprange(kpagetable, (uint64_t)trapframes[0].trapstack - PGSIZE, \
-            (uint64_t)(trapframes[0].trapstack), PTE_R|PTE_W);
-
-    // the trap frame itself is stored in the mcratch register
-    maprange(kpagetable, r_mscratch(), r_mscratch() + sizeof(struct trapframe) * 8, PTE_R|PTE_W);
+    // the first user process.
+    uint64_t addr = proc_init();
+    printf("init process created at address 0x%x\n", addr);
+#ifdef BENCH
+    // make bench: run the benchmarks once the scheduler is up.
+    if (proc_kthread(bench, NULL) == NULL) {
+        panic("kinit: can't start the benchmarks");
+    }
+#endif
 
     printpagealloc();
     //uint64_t p = (uint64_t)trapframes[0].trapstack - 1;
@@ -118,31 +236,29 @@ void kinit() {
     //p = CLINT_MTIMECMP(0);
     //printf("walk 0x%x -> 0x%x\n", p, va2pa(kpagetable, p));
 
-    // the following shows how we're going to walk to translate a virtual
-    // address into a physical address. we will use this whenever a user
-    // space application requires services. since the user space application
-    // only knows virtual address, we have to translate silently behind
-    // the success.
-    printf("setting %p\n", satp_val);
-    printf("scratch reg = 0x%x\n", r_mscratch());
-    w_satp(satp_val);
-    satp_fence_asid(0);
-
-    // kinit() runs in machine mode
-    // the job of kinit is to get us into supervisor mode
-    // as soon as possible.
-
-    plic_setthreshold(0);
+    // the priority of an interrupt source is global, the enable bits
+    // and the threshold are per context, every hart sets up its own.
     // virtio = [1..8]
     // uart0 = 10
     // pcie = [32..35]
-    // enable uart interrupt
-    plic_enable(10);
     plic_setpriority(10, 1);
-    printf("UART interrupts have been enabled and are awaiting command\n");
-    printf("Getting ready for first precess.\n");
-    printf("issuing the first context switch timer\n");
-    *(uint64_t*)CLINT_MTIMECMP(0) = *(uint64_t*)CLINT_MTIME + 10000000;
+
+    // the global state is ready: release the parked harts, they
+    // run the rest of their initialization in parallel with us.
+    // they can't take a spinlock without their cpu, so they get it
+    // from us.
+    boot_start = r_time();
+    for (uint64_t hart = 1; hart < NCPU; hart++) {
+        if (!(_bootharts() & (1UL << hart))) {
+            continue;
+        }
+        if (!cpualloc(hart)) {
+            panic("no cpu for hart%d", hart);
+        }
+        WREG(CLINT_MSIP(hart), 1);
+    }
+    _kinithart(0);
+    _kbarrier(0);
 
     //uint64_t f, m, s;
     //scheduler(&f, &m, &s);
@@ -155,46 +271,50 @@ void kinit() {
     //return addr;
 }
 
-void kinit_hart(uint64_t hartid) {
-    // all non-zero harts initialize here
-    // we have to store the kernel's table. the table will be
-    // moved back and forth between the kernel's table and
-    // user applications' tables.
-    w_mscratch((uint64_t)(&trapframes[hartid]));
-    // copy the same mscratch over to the supervisor version of 
-    // the same register
-    w_sscratch(r_mscratch());
-    trapframes[hartid].hartid = hartid;
+// end the emulation, qemu exits with code. mtime starts at 0 when
+// the machine is reset, so it tells how long the whole run took.
+void poweroff(int code) {
+    printf("poweroff: exit %d after %ld ms\n", code, r_time() * 1000 / TIMEBASE);
+    uartflush();
+    if (code == EXIT_PASS) {
+        WREG(VIRT_TEST, VIRT_TEST_PASS);
+    } else {
+        WREG(VIRT_TEST, (code << 16) | VIRT_TEST_FAIL);
+    }
+    // the other harts keep running until qemu gets to the write.
+    while (1) {
+        asm volatile("wfi");
+    }
+}
 
-    //*(uint64_t*)CLINT_MTIMECMP(hartid) = *(uint64_t*)CLINT_MTIME + 10000000;
-    printf("hart%d bool\n", hartid);
+void kinit_hart(uint64_t hartid) {
+    // all non-zero harts initialize here, once hart 0 has sent
+    // them a software interrupt.
+    if (!_kjoin(hartid)) {
+        // too late, hart 0 gave up waiting for us and frees our cpu.
+        while (1) {
+            asm volatile("wfi");
+        }
+    }
+    // from now on tp points to our per-cpu block.
+    w_tp((uint64_t)cpus[hartid]);
+    cpuinithart(hartid);
+    _kinithart(hartid);
+    _kbarrier(hartid);
 }
 
 void kmain() {
     // kmain() starts in supervisor mode, so we should have the trap
-    // vector setup and MMU turned on when get here.
-    printf("hello, os world\n");
-    //printf("%d: hello, os world!\n", r_mhartid());
-
-    // set the next machine timer to fire
-    *(uint64_t*)CLINT_MTIMECMP(0) = *(uint64_t*)CLINT_MTIME + 10000000;
+    // vector setup and MMU turned on when get here. every hart
+    // gets here once all of them are past the barrier.
+    printf("hart%d: hello, os world\n", cpuid());
 
     // try to cause a page fault
     //uint64_t *v = 0;
     //*v = 1;
 
-    // set the interrupt system via the PLIC, have to set the threshold to
-    // something that won't mask all interrupts.
-    printf("Setting up interrupts and PLIC...\n");
-    // lower the threshold wall so all interrupts can jump over it.
-    plic_setthreshold(0);
-    // virtio = [1..8]
-    // uart0 = 10
-    // pcie = [32..35]
-    // enable uart interrupt
-    plic_enable(10);
-    plic_setpriority(10, 1);
-    printf("UART interrupts have been enabled\n");
-   
-    while (1) {}
+    // from here on, the hart runs processes, the scheduler runs in
+    // machine mode. ask for it with an ecall, it never comes back.
+    asm volatile("ecall");
+    panic("kmain: back from the scheduler");
 }
@@ -2,11 +2,39 @@
 #include "include/types.h"
 #include "include/riscv.h"
 #include "include/memlayout.h"
+#include "include/spinlock.h"
+#include "include/cpu.h"
+#include "include/perf.h"
+#include "include/trace.h"
+#include "include/page.h"
 
 // mark the start of the actual memory we can dish out.
 static uint64_t _alloc_start = 0;
 static uint64_t num_pages;
 
+// protects the page structures and the zeroed page pool,
+// pages are allocated from every hart.
+static struct spinlock pagelock;
+
+// pool of pages that are already zeroed, so pagezalloc(1) on the
+// allocating path is just a pop. an idle hart refills it in the
+// background with pagezpoolfill().
+#define ZPOOL_SIZE 64
+#define ZPOOL_LOW 16
+static void *zpool[ZPOOL_SIZE];
+static int zpool_num;
+// hart that refills the pool, woken by a software interrupt when
+// the pool runs low. -1 if no hart is idle.
+static int zpool_hart = -1;
+
+// a single page of zeroes, mapped read-only wherever anonymous
+// memory is read before it is ever written.
+static void *zeropage;
+
+// frames of dead processes, freed by an idle hart, or by the first
+// allocation that finds no room without them. see pagedefer().
+static struct pagebatch deferred;
+
 typedef enum {
     empty = 0,
     taken = (1<<0), // is current page allocated?
@@ -51,90 +79,124 @@ void _clear(page *p) {
 // 1. free list (singly linked list where it starts at the first free allocation)
 // 2. bookkeeping list (structure contains a taken and length)
 // 3. allocate on page structure per 4096 bytes. (V)
-void pageinit() {
-    num_pages = (HEAP_SIZE / PGSIZE) - 8;
-    printf("HEAP_START = 0x%x, HEAP_SIZE = 0x%x, num of pages = %d\n",
-        HEAP_START, HEAP_SIZE, num_pages);
+// the heap runs from the end of the kernel to end, the end of RAM.
+void pageinit(uint64_t end) {
+    // the page structures come first, as many pages of them as it
+    // takes to describe the rest of the heap, one byte per page.
+    uint64_t total = (PGROUNDDOWN(end) - HEAP_START) / PGSIZE;
+    uint64_t ndesc = (total + PGSIZE) / (PGSIZE + 1);
+
+    // Determin where the actual useful memory start.
+    // After all page structures. Also, align the ALLOC_START
+    // to a page-boundary (PAGESIZE = 4096). 
+    _alloc_start = PGROUNDUP(HEAP_START + ndesc * PGSIZE);
+    num_pages = (PGROUNDDOWN(end) - _alloc_start) / PGSIZE;
+    printf("HEAP_START = 0x%lx, end = 0x%lx, num of pages = %ld\n",
+        HEAP_START, end, num_pages);
 
     page *ptr = (page *)HEAP_START;
     // clear all pages
-    for (int i = 0; i < num_pages; i++) {
+    for (uint64_t i = 0; i < num_pages; i++) {
         _clear(ptr++);
     }
 
-    // Determin where the actual useful memory start.
-    // After all page structures. Also, align the ALLOC_START
-    // to a page-boundary (PAGESIZE = 4096). 
-    _alloc_start = PGROUNDUP(HEAP_START + 8 * PGSIZE);
+    spin_init(&pagelock);
+
+    zeropage = pagezalloc(1);
+    if (zeropage == NULL) {
+        panic("pageinit: no page for the zero page");
+    }
 
     printf("page init...\n");
 }
 
-// Allocate pages
-void *pagealloc(int np) {
-    assert(np > 0);
+// find the first free page structure in [from, to),
+// return to if there is none.
+PATCHABLE uint64_t pagefindfree(page *ptr, uint64_t from, uint64_t to) {
+    while (from < to && _istaken(ptr + from)) {
+        from++;
+    }
+    return from;
+}
 
+// the alternatives below are RISC-V assembly, they are left out of
+// the host test build in kernel/test/host.
+#ifdef __riscv
+// same as above, eight page structures at a time. orc.b (Zbb) turns
+// every non-zero byte of a doubleword into 0xff, so the first free
+// structure is the first zero byte left, found with ctz.
+uint64_t pagefindfree_zbb(page *ptr, uint64_t from, uint64_t to) {
+    uint8_t *f = (uint8_t*)ptr;
+    while (from < to && (from & 7)) {
+        if (f[from] == empty) {
+            return from;
+        }
+        from++;
+    }
+    for (; from + 8 <= to; from += 8) {
+        uint64_t w = *(uint64_t*)(f + from);
+        uint64_t x;
+        // orc.b x, w
+        asm(".insn i 0x13, 5, %0, %1, 0x287" : "=r" (x) : "r" (w));
+        if (x != ~0UL) {
+            // ctz x, ~x
+            asm(".insn i 0x13, 1, %0, %1, 0x601" : "=r" (x) : "r" (~x));
+            return from + x / 8;
+        }
+    }
+    while (from < to && f[from] != empty) {
+        from++;
+    }
+    return from;
+}
+
+ALTERNATIVE(pagefindfree, pagefindfree_zbb, CPU_ZBB);
+#endif
+
+// Allocate pages, called with pagelock held.
+void *_pagealloc(int np) {
     // reserved 8 page (8 * 4096) to hold the page structure
     // It should be allocated enough space to manage whole memory space of 128MB.
     page *ptr = (page *)HEAP_START;
-    bool found = false;
-    for (int i = 0; i < num_pages - np; i++) {
-        // allocate a free page
-        if (_isfree((ptr + i))) {
-            found = true;
-            for (int j = i; j <= i + np; j++) {
-                // check if there're contiguous allocation.
-                // if not, check somewhere else;
-                if (_istaken((ptr + j)))  {
-                    found = false;
-                    break;
-                }
-            }
+    uint64_t i = 0;
+    while (i + np <= num_pages) {
+        // skip straight to the next free page.
+        i = pagefindfree(ptr, i, num_pages);
+        if (i + np > num_pages) {
+            break;
+        }
+
+        // check if there're contiguous allocation.
+        // if not, check somewhere else after the taken page.
+        uint64_t j = i + 1;
+        while (j < i + np && _isfree(ptr + j)) {
+            j++;
+        }
+        if (j < i + np) {
+            i = j + 1;
+            continue;
         }
 
         // here have checken whether there are enough contiguous pages
         // to form what we need.
-        if (found) {
-            for (int k = i; k < i + np - 1; k++) {
-                _setflag((ptr + k), taken);
-            }
-            _setflag((ptr+(i+np-1)), taken);
-            _setflag((ptr+(i+np-1)), last);
-            return (void*)(_alloc_start + i * PGSIZE);
+        for (uint64_t k = i; k < i + np - 1; k++) {
+            _setflag((ptr + k), taken);
         }
+        _setflag((ptr+(i+np-1)), taken);
+        _setflag((ptr+(i+np-1)), last);
+        return (void*)(_alloc_start + i * PGSIZE);
     }
 
     return NULL;
 }
 
-// Allocate and zero pages.
-void *pagezalloc(int np) {
-    void *ps = pagealloc(np);
-    if (ps == NULL) {
-        return NULL;
-    }
-
-    // get the raw allocation.
-    uint64_t size = (PGSIZE * np) / 8;
-    uint64_t *ptr = (uint64_t*)ps;
-    for (uint64_t i = 0; i < size; i++) {
-        // the reason to use uint64_t ptr is force sd(store doubleword).
-        // rather than sb. This means 8x fewer stores than before.
-        // Typically we have to be concerned about remaining bytes, but
-        // fortunately 4096 % 8 == 0, so won't have any remaining bytes.
-        ptr[i] = 0;
-    }
-
-    return ps;
-}
-
-// Deallocate a page.
+// Deallocate a page, called with pagelock held.
 // It will automatically colesce contiguous pages.
-void pagedealloc(page *p) {
+void _pagedealloc(page *p) {
     /*
 	 * Assert (TBD) if p is invalid
 	 */
-	if (p == NULL || (uint64_t)p >= (HEAP_START + HEAP_SIZE)) {
+	if (p == NULL || (uint64_t)p >= _alloc_start + num_pages * PGSIZE) {
 		panic("pagedealloc: dealloc a page that is out of range");
 	}
 	/* get the first page descriptor of this memory block */
@@ -152,6 +214,194 @@ void pagedealloc(page *p) {
     _clear(ptr);
 }
 
+static void _pagedeallocbatch(struct pagebatch *b) {
+    for (void *pa = b->head; pa != NULL; ) {
+        void *next = *(void**)pa;
+        _pagedealloc(pa);
+        pa = next;
+    }
+    b->head = b->tail = NULL;
+    b->n = 0;
+}
+
+// Allocate pages
+void *pagealloc(int np) {
+    assert(np > 0);
+    perf_count(PERF_PAGEALLOC);
+
+    spin_acquire(&pagelock);
+    void *ps = _pagealloc(np);
+    if (ps == NULL && deferred.head != NULL) {
+        _pagedeallocbatch(&deferred);
+        ps = _pagealloc(np);
+    }
+    if (ps == NULL && zpool_num > 0) {
+        // the pool may be holding exactly the pages we need,
+        // give them back and try again.
+        while (zpool_num > 0) {
+            _pagedealloc(zpool[--zpool_num]);
+        }
+        ps = _pagealloc(np);
+    }
+    spin_release(&pagelock);
+    trace(TR_PAGEALLOC, np, (uint64_t)ps, 0);
+    return ps;
+}
+
+// zero np pages.
+PATCHABLE void pagezero(void *pa, int np) {
+    memset(pa, 0, PGSIZE * np);
+}
+
+// cbo.zero (Zicboz) zeroes a whole cache block per instruction without
+// reading it into the cache first.
+void pagezero_cbo(void *pa, int np) {
+    uint8_t *end = (uint8_t*)pa + PGSIZE * np;
+    for (uint8_t *b = pa; b < end; b += cbozero_size) {
+        cbo_zero(b);
+    }
+}
+
+ALTERNATIVE(pagezero, pagezero_cbo, CPU_ZICBOZ);
+
+// Allocate and zero pages.
+// single pages come from the pool of pre-zeroed pages when it has any.
+void *pagezalloc(int np) {
+    if (np == 1) {
+        void *ps = NULL;
+        spin_acquire(&pagelock);
+        if (zpool_num > 0) {
+            ps = zpool[--zpool_num];
+        }
+        int hart = zpool_hart;
+        bool low = zpool_num < ZPOOL_LOW;
+        spin_release(&pagelock);
+        if (low && hart >= 0) {
+            // wake the idle hart so it tops the pool up again.
+            WREG(CLINT_MSIP(hart), 1);
+        }
+        if (ps != NULL) {
+            perf_count(PERF_PAGEALLOC);
+            trace(TR_PAGEALLOC, 1, (uint64_t)ps, 0);
+            return ps;
+        }
+    }
+
+    void *ps = pagealloc(np);
+    if (ps == NULL) {
+        return NULL;
+    }
+    pagezero(ps, np);
+    return ps;
+}
+
+// zero one more page for the pool.
+// return false once the pool is full or memory has run out,
+// so an idle hart can call this until there's nothing left to do.
+bool pagezpoolfill() {
+    spin_acquire(&pagelock);
+    void *ps = NULL;
+    if (zpool_num < ZPOOL_SIZE) {
+        ps = _pagealloc(1);
+    }
+    spin_release(&pagelock);
+    if (ps == NULL) {
+        return false;
+    }
+
+    // zero outside the lock, the page isn't visible to anyone yet.
+    pagezero(ps, 1);
+
+    spin_acquire(&pagelock);
+    if (zpool_num < ZPOOL_SIZE) {
+        zpool[zpool_num++] = ps;
+    } else {
+        // another hart filled the last slot meanwhile.
+        _pagedealloc(ps);
+    }
+    spin_release(&pagelock);
+    return true;
+}
+
+// make hart the one that refills the pool when it runs low.
+void pagezpoolhart(int hart) {
+    spin_acquire(&pagelock);
+    zpool_hart = hart;
+    spin_release(&pagelock);
+}
+
+// the hart that refills the pool, -1 if there's none.
+int pagezpoolgethart() {
+    return zpool_hart;
+}
+
+// the shared page of zeroes.
+void *getzeropage() {
+    return zeropage;
+}
+
+// Deallocate a page.
+void pagedealloc(page *p) {
+    perf_count(PERF_PAGEFREE);
+    trace(TR_PAGEFREE, 0, (uint64_t)p, 0);
+    spin_acquire(&pagelock);
+    _pagedealloc(p);
+    spin_release(&pagelock);
+}
+
+// add the allocation at pa to b. pa isn't used anymore, its
+// first word links it to the next one.
+void pagebatchadd(struct pagebatch *b, void *pa) {
+    *(void**)pa = b->head;
+    b->head = pa;
+    if (b->tail == NULL) {
+        b->tail = pa;
+    }
+    b->n++;
+}
+
+// free everything in b right away.
+void pagedeallocbatch(struct pagebatch *b) {
+    spin_acquire(&pagelock);
+    _pagedeallocbatch(b);
+    spin_release(&pagelock);
+}
+
+// leave the frames in b to an idle hart, so whoever tears down an
+// address space doesn't wait for them. b is empty afterwards.
+void pagedefer(struct pagebatch *b) {
+    if (b->head == NULL) {
+        return;
+    }
+    spin_acquire(&pagelock);
+    *(void**)b->tail = deferred.head;
+    deferred.head = b->head;
+    if (deferred.tail == NULL) {
+        deferred.tail = b->tail;
+    }
+    deferred.n += b->n;
+    int hart = zpool_hart;
+    spin_release(&pagelock);
+    b->head = b->tail = NULL;
+    b->n = 0;
+    // the pool's hart reclaims them when it's woken up.
+    if (hart >= 0) {
+        WREG(CLINT_MSIP(hart), 1);
+    }
+}
+
+// free the deferred frames, called by idle harts.
+// return false if there were none.
+bool pagereclaim() {
+    if (deferred.head == NULL) {
+        return false;
+    }
+    spin_acquire(&pagelock);
+    _pagedeallocbatch(&deferred);
+    spin_release(&pagelock);
+    return true;
+}
+
 // Print all page allocations.
 void printpagealloc() {
     page *st = (page*)HEAP_START;
@@ -182,6 +432,7 @@ void printpagealloc() {
             }
         }
         st++;
+        cond_resched();
     }
     printf("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
     printf("Allocated: %d pages %d bytes\n", num, num * PGSIZE);
@@ -300,32 +551,74 @@ void pagemap(pagetable_t pagetable, uint64_t va, uint64_t pa, uint64_t bits, uin
     pte = &pagetable[PX(0, va)];
     *pte = (ppn2 << 28) | (ppn1 << 19) | (ppn0 << 10) | bits | PTE_V;
     //*pte = PA2PTE(pa) | bits | PTE_V;
-    printf("%d: map va 0x%x to pa 0x%x, actual 0x%x, pte 0x%x\n", 
-            i, va, pa, va2pa(pagetable, va), *pte);
 }
 
-// umap(): unmap and free all memory associated with a table.
-// don't free root pagetable, for it's usually embedden into process structure.
-void pageumap(pagetable_t pagetable) {
+static void _pageumap(pagetable_t table, int level, struct pagebatch *b) {
     for (int i = 0; i < 512; i++) {
-        pte_t pte1 = pagetable[i];
-        if ((pte1 & PTE_V) && (!_isleaf(pte1))) {
-            // this is a valid entry, so drill down and free
-            uint64_t child = PTE2PA(pte1);
-            pagetable_t childtable = (pagetable_t)child;
-            for (int j = 0; j < 512; j++) {
-                pte_t pte2 = childtable[j];
-                if ((pte2 & PTE_V) && (!_isleaf(pte2))) {
-                    uint64_t pa = PTE2PA(pte2);
-                    // the next level is level 0, free here.
-                    pagedealloc((page*)pa);
-                }
+        pte_t pte = table[i];
+        if (!(pte & PTE_V)) {
+            continue;
+        }
+        if (_isleaf(pte)) {
+            // shared frames belong to somebody else, the zero page
+            // or the program image.
+            if (!(pte & PTE_SHARED)) {
+                pagebatchadd(b, (void*)PTE2PA(pte));
             }
-            pagedealloc((page*)child);
+        } else if (level > 0) {
+            // the table is done with once its own entries are.
+            _pageumap((pagetable_t)PTE2PA(pte), level - 1, b);
+            pagebatchadd(b, (void*)PTE2PA(pte));
         }
     }
 }
 
+// umap(): unmap all memory associated with a table, all three levels.
+// the frames it maps and the tables below the root go into b, the
+// caller frees them once the TLBs have forgotten the table.
+// don't free root pagetable, for it's usually embedden into process structure.
+void pageumap(pagetable_t pagetable, struct pagebatch *b) {
+    _pageumap(pagetable, 2, b);
+}
+
+// flush the TLB entries of np pages starting at va in address space asid.
+// past a handful of pages flushing the whole address space is cheaper.
+PATCHABLE void pageflush(uint64_t va, uint64_t np, uint64_t asid) {
+    if (np > 16) {
+        perf_count(PERF_TLBFENCE);
+        satp_fence_asid(asid);
+        return;
+    }
+    for (uint64_t i = 0; i < np; i++) {
+        perf_count(PERF_TLBFENCE);
+        sfence_vma_page(va + i * PGSIZE, asid);
+    }
+}
+
+#ifdef __riscv
+// Svinval splits sfence.vma into the invalidations themselves, which
+// don't wait on each other, and one fence on each side of the batch.
+void pageflush_svinval(uint64_t va, uint64_t np, uint64_t asid) {
+    if (np > 64) {
+        perf_count(PERF_TLBFENCE);
+        satp_fence_asid(asid);
+        return;
+    }
+    // sfence.w.inval
+    asm volatile(".insn i 0x73, 0, x0, x0, 0x180" : : : "memory");
+    for (uint64_t i = 0; i < np; i++) {
+        // sinval.vma va, asid
+        perf_count(PERF_TLBFENCE);
+        asm volatile(".insn r 0x73, 0, 0x0b, x0, %0, %1"
+                     : : "r" (va + i * PGSIZE), "r" (asid) : "memory");
+    }
+    // sfence.inval.ir
+    asm volatile(".insn i 0x73, 0, x0, x0, 0x181" : : : "memory");
+}
+
+ALTERNATIVE(pageflush, pageflush_svinval, CPU_SVINVAL);
+#endif
+
 // walk the page to convert a virtual address to a physical address.
 // if a page fault would occur, return none.
 // otherwise, return with the physical address.
@@ -350,6 +643,23 @@ uint64_t va2pa(pagetable_t pagetable, uint64_t va) {
     return 0;
 }
 
+// the level-0 PTE for va, NULL if the tables above it don't exist.
+pte_t *pagewalk(pagetable_t pagetable, uint64_t va) {
+    for (int i = 2; i > 0; i--) {
+        pte_t pte = pagetable[PX(i, va)];
+        if (!(pte & PTE_V) || _isleaf(pte)) {
+            return NULL;
+        }
+        pagetable = (pagetable_t)PTE2PA(pte);
+    }
+    return &pagetable[PX(0, va)];
+}
+
 uint64_t getallocstart() {
     return _alloc_start;
 }
+
+// number of pages the allocator manages.
+uint64_t pagecount() {
+    return num_pages;
+}
@@ -0,0 +1,97 @@
+#include "include/types.h"
+#include "include/riscv.h"
+#include "include/defs.h"
+#include "include/param.h"
+#include "include/proc.h"
+#include "include/perf.h"
+
+DEFINE_PER_CPU(uint64_t, perf_sw[PERF_NSW]);
+
+static const char *perf_names[PERF_NSW] = {
+    [PERF_TRAP]      = "traps",
+    [PERF_SOFTIRQ]   = "soft irqs",
+    [PERF_SOFTIRQ_ENTRY]  = "soft irq entry cycles",
+    [PERF_TIMERIRQ]  = "timer irqs",
+    [PERF_TIMERIRQ_ENTRY] = "timer irq entry cycles",
+    [PERF_EXTIRQ]    = "external irqs",
+    [PERF_EXTIRQ_ENTRY]   = "external irq entry cycles",
+    [PERF_SYSCALL]   = "syscalls",
+    [PERF_PGFAULT]   = "page faults",
+    [PERF_CTXSW]     = "context switches",
+    [PERF_TLBFENCE]  = "tlb fences",
+    [PERF_PAGEALLOC] = "page allocs",
+    [PERF_PAGEFREE]  = "page frees",
+    [PERF_SLABALLOC] = "slab allocs",
+    [PERF_UARTDROP]  = "console bytes dropped",
+};
+
+// let the hardware counters run on this hart, and let supervisor and
+// user mode read cycle, time, instret and hpmcounter3..31 directly.
+// what the hpm counters count is up to the platform, they count
+// nothing until an event is written to their mhpmevent register.
+void perfinithart() {
+    w_mcountinhibit(0);
+    w_mcounteren(0xffffffff);
+    w_scounteren(0xffffffff);
+}
+
+// the csr number is part of the instruction, so one case per counter.
+static uint64_t _hpmread(uint64_t n) {
+    uint64_t x = 0;
+    switch (n) {
+#define HPM(i) case i: asm volatile("csrr %0, mhpmcounter" #i : "=r" (x)); break;
+    HPM(3)  HPM(4)  HPM(5)  HPM(6)  HPM(7)  HPM(8)  HPM(9)  HPM(10)
+    HPM(11) HPM(12) HPM(13) HPM(14) HPM(15) HPM(16) HPM(17) HPM(18)
+    HPM(19) HPM(20) HPM(21) HPM(22) HPM(23) HPM(24) HPM(25) HPM(26)
+    HPM(27) HPM(28) HPM(29) HPM(30) HPM(31)
+#undef HPM
+    }
+    return x;
+}
+
+// the value of ev: software events summed over all harts, hardware
+// counters of the calling hart. 0 for events that don't exist.
+uint64_t perf_read(uint64_t ev) {
+    if (ev < PERF_NSW) {
+        uint64_t sum = 0;
+        for (int hart = 0; hart < NCPU; hart++) {
+            if (cpus[hart] != NULL) {
+                sum += per_cpu(perf_sw, hart)[ev];
+            }
+        }
+        return sum;
+    }
+    if (ev == PERF_CYCLE) {
+        return r_mcycle();
+    }
+    if (ev == PERF_INSTRET) {
+        return r_minstret();
+    }
+    if (ev >= PERF_HPM(3) && ev < PERF_NEVENTS) {
+        return _hpmread(ev - PERF_CYCLE);
+    }
+    return 0;
+}
+
+// print the software counters of every hart, and the hardware
+// counters of this one. printf() can't pad, the columns are tabbed.
+void perf_dump() {
+    printf("event\t");
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] != NULL) {
+            printf("\thart%d", hart);
+        }
+    }
+    printf("\n");
+    for (int ev = 0; ev < PERF_NSW; ev++) {
+        printf("%s\t", perf_names[ev]);
+        for (int hart = 0; hart < NCPU; hart++) {
+            if (cpus[hart] != NULL) {
+                printf("\t%ld", per_cpu(perf_sw, hart)[ev]);
+            }
+        }
+        printf("\n");
+    }
+    printf("hart%d: %ld cycles, %ld instructions retired\n",
+           cpuid(), r_mcycle(), r_minstret());
+}
@@ -12,12 +12,17 @@
 // UART0 = 10
 // PCIE (PCI express devices) = [32..35]
 
+// every hart has its own machine-mode context in the PLIC, with its
+// own enable bits, threshold and claim register. an interrupt enabled
+// in several contexts is delivered to all of them, whoever claims it
+// first handles it and the others get a 0 back from the claim.
+
 // get the next available interrupt. this is the 'claim' process.
 // the plic will automatically sort by priority and hand us the
 // ID of the interrupt, for example if the UART is interrupting
 // and it's next, we will get the value 10.
-uint32_t plic_next() {
-    return RREG(PLIC_CLAIM);
+uint32_t plic_next(uint64_t hart) {
+    return RREG(PLIC_MCLAIM(hart));
 }
 
 // complete a pending interrupt by id. the id should come
@@ -33,23 +38,23 @@ uint32_t plic_next() {
 // and wait for that device to interrupt again in the future.
 // the resets the system and lets us cycle back to the claim/complete
 // over and over again.
-void plic_complete(uint32_t id) {
+void plic_complete(uint64_t hart, uint32_t id) {
     // we actually write a uint32_t into the entire complete_register
     // this is the same register as the claim register, but it can
     // differentiate based on whether we're reading or writing.
-    WREG(PLIC_CLAIM, id);
+    WREG(PLIC_MCLAIM(hart), id);
 }
 
-// set the global threshold. the threshold can be a value [0..7]
+// set the hart's threshold. the threshold can be a value [0..7]
 // the plic will mask any interrupts at or below the given threshold.
 // this means that a threshold of 7 will mask ALL interrupts and
 // a threshold of 0 will allow ALL interrupts. mask means the interrupt
 // is disabled.
-void plic_setthreshold(uint8_t tsh) {
+void plic_setthreshold(uint64_t hart, uint8_t tsh) {
     // do tsh because use a u8, but maximum number is 3-bit 0b111
     // so and 0b1111 to get the last three bits.
     uint8_t actual_tsh = tsh & 7;
-    WREG(PLIC_THRESHOLD, actual_tsh);
+    WREG(PLIC_MPRIORITY(hart), actual_tsh);
 }
 
 // see if a given interrupt id is pending
@@ -59,13 +64,13 @@ bool plic_ispending(uint32_t id) {
     return actual_id & pend_ids;
 }
 
-// enable a given interrupt id
+// enable a given interrupt id for the hart
 // because device connected through which interrupt, we enable
 // that interrupt by writing 1 << id into the interrupt enable
 // register.
-void plic_enable(uint32_t id) {
-    uint32_t enables = RREG(PLIC_INT_ENABLE);
-    WREG(PLIC_INT_ENABLE, enables | (1 << id));
+void plic_enable(uint64_t hart, uint32_t id) {
+    uint32_t enables = RREG(PLIC_MENABLE(hart));
+    WREG(PLIC_MENABLE(hart), enables | (1 << id));
 }
 
 // set a given interrupt priority to the given priority
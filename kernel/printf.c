@@ -6,8 +6,24 @@
 
 #include "include/defs.h"
 #include "include/types.h"
+#include "include/memlayout.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/param.h"
 
+// writers that may sleep format into outbuf and hold it until the
+// UART has taken the whole line, they can sleep in uartputc() on a
+// full console. print_lock only guards the printing flag, waiting for
+// outbuf sleeps.
 static char outbuf[1000];
+static struct spinlock print_lock;
+static bool printing;
+// trap handlers, code holding locks and panic() can't wait for
+// outbuf, they use a buffer of their hart's. machine mode traps don't
+// nest, but they do interrupt kmain() in supervisor mode, each mode
+// has its own. not per-cpu data, a hart's block has to fit a page.
+static char hartbuf[NCPU][2][1000];
+static volatile bool panicking;
 
 static int _vsnprintf(char *out, size_t n, const char *s, va_list vl) {
     int format = 0;
@@ -108,6 +124,35 @@ static int _vsnprintf(char *out, size_t n, const char *s, va_list vl) {
     return pos;
 }
 
+// the same test uartputc() makes before it sleeps on a full console,
+// a process that had interrupts on.
+static bool _printsleepable() {
+    if (panicking) {
+        return false;
+    }
+    push_off();
+    struct cpu *c = mycpu();
+    bool ok = c->proc != NULL && c->noff == 1 && c->intena;
+    pop_off();
+    return ok;
+}
+
+static void _printacquire() {
+    spin_acquire(&print_lock);
+    while (printing) {
+        sleep(&printing, &print_lock);
+    }
+    printing = true;
+    spin_release(&print_lock);
+}
+
+static void _printrelease() {
+    spin_acquire(&print_lock);
+    printing = false;
+    wakeup(&printing);
+    spin_release(&print_lock);
+}
+
 int _vprintf(const char *s, va_list vl) {
     int res = _vsnprintf(NULL, -1, s, vl);
     if (res + 1 >= sizeof(outbuf)) {
@@ -115,8 +160,19 @@ int _vprintf(const char *s, va_list vl) {
         while (1)
             ;
     }
+    if (!_printsleepable()) {
+        push_off();
+        struct cpu *c = mycpu();
+        char *buf = hartbuf[c->hartid][c->mmode];
+        _vsnprintf(buf, res + 1, s, vl);
+        uartputs(buf);
+        pop_off();
+        return res;
+    }
+    _printacquire();
     _vsnprintf(outbuf, res + 1, s, vl);
     uartputs(outbuf);
+    _printrelease();
     return res;
 }
 
@@ -130,14 +186,16 @@ int printf(const char *s, ...) {
 }
 
 void panic(const char *s, ...) {
+    // the writer holding outbuf may be asleep, or be us.
+    panicking = true;
+    uartpanic();
     printf("panic: ");
     va_list vl;
     va_start(vl, s);
     _vprintf(s, vl);
     va_end(vl);
     printf("\n");
-    while (1)
-        ;
+    poweroff(EXIT_PANIC);
 }
 
 void assert(bool flag) {
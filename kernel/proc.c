@@ -1,43 +1,48 @@
 #include "include/proc.h"
 #include "include/defs.h"
+#include "include/memlayout.h"
 #include "include/spinlock.h"
+#include "include/slab.h"
+#include "include/page.h"
 
-// store a process list, uses the global allocator that made before
-// and its job is to store all processes. we will have this list OWN
-// the process. so anytime want the process, consult the process list.
-struct proc procs[NPROC];
-struct cpu cpus[NCPU];
+// processes are allocated from a slab as they are created, so no
+// memory is set aside for ones that don't exist. the limit comes from
+// the memory there is: every process holds on to at least PROC_PAGES
+// pages (trap frame, kernel stack, page tables, a few user pages).
+#define PROC_PAGES 8
+static struct slab procslab;
+static uint64_t nproc;
+static uint64_t proc_max;
+
+// the boot hart's cpu is at the start of the per-cpu block the
+// linker laid out, it needs it before there is any allocator. the
+// others get a block from a slab, see cpualloc().
+DEFINE_PER_CPU_FIRST(struct cpu, cpu0);
+static struct slab cpuslab;
+struct cpu *cpus[NCPU] = { &cpu0 };
 
 extern void switch_to_user(uint64_t frame, uint64_t mepc, uint64_t satp);
 
-extern uint64_t make_syscall(uint64_t);
-
-// search through the process list to get a new PID, but
-// it's probably easier and faster to increase the pid.
-uint16_t next_pid = 1;
-struct spinlock pid_lock;
-
-// eventually move this function out of here, but its
-// job is just to take a slot in the process list.
-void initcode() {
-    uint64_t i = 0;
-    while (1) {
-        i += 1;
-        if (i > 70000000) {
-            make_syscall(1);
-            i = 0;
-        }
-    }    
- }
+// the first user program, an ELF executable built from user/initcode.c
+// and embedded page-aligned into the kernel image by initcode.S.
+extern uint8_t _initcode_start[];
+extern uint8_t _initcode_end[];
+
+// processes are found by pid in a hash table, linked through
+// p->pidnext. proc_lock protects it, nproc and next_pid.
+#define NPIDHASH 512
+static struct proc *pidhash[NPIDHASH];
+static uint32_t next_pid = 1;
+static struct spinlock proc_lock;
 
 uint64_t proc_init() {
     struct proc *p;
-    spin_init(&pid_lock);
-    for (p = procs; p < &procs[NPROC]; p++) {
-        spin_init(&p->lock);
-    }
+    spin_init(&proc_lock);
+    slab_init(&procslab, sizeof(struct proc));
+    proc_max = pagecount() / PROC_PAGES;
+    printf("room for %d processes\n", proc_max);
 
-    p = proc_alloc(initcode);
+    p = proc_alloc(_initcode_start, _initcode_end - _initcode_start);
     if (p == NULL) {
         panic("can't alloc new proc");
     }
@@ -55,53 +60,288 @@ uint64_t proc_init() {
     return p->pc;
  }
 
-uint16_t proc_allocpid() {
-    int pid;
+static struct proc *_pidlookup(uint32_t pid) {
+    struct proc *p = pidhash[pid % NPIDHASH];
+    while (p != NULL && p->pid != pid) {
+        p = p->pidnext;
+    }
+    return p;
+}
 
-    spin_acquire(&pid_lock);
-    pid = next_pid;
-    next_pid++;
-    spin_release(&pid_lock);
+// is the ASID of pid taken by a live process? pids with the same
+// ASID have the same low 16 bits, so they are in the same hash chain.
+static bool _asidinuse(uint32_t pid) {
+    for (struct proc *p = pidhash[pid % NPIDHASH]; p != NULL; p = p->pidnext) {
+        if (ASID(p) == (pid & 0xffff)) {
+            return true;
+        }
+    }
+    return false;
+}
 
+// pids are 32 bits and handed out in increasing order, so a pid
+// doesn't come back until the counter wraps around, and then the
+// ones still in use are skipped, together with the ones that would
+// share an ASID with a live process or the kernel.
+// caller holds proc_lock.
+static uint32_t _allocpid() {
+    uint32_t pid;
+    do {
+        pid = next_pid++;
+    } while ((pid & 0xffff) == 0 || _asidinuse(pid));
     return pid;
 }
 
-// look in the process table for an UNUSED proc.
-// if found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// if there are no free proces, or a memory allocation fails, return 0.
-struct proc* proc_alloc(void* fn) {
-    uint64_t fn_pa = (uint64_t)fn;
-    uint64_t fn_va = fn_pa;
+// allocate a new process and give it a pid.
+// returns with p->lock held, NULL if there's no room.
+static struct proc *_procget() {
+    spin_acquire(&proc_lock);
+    if (nproc >= proc_max) {
+        spin_release(&proc_lock);
+        return NULL;
+    }
+    nproc++;
+    spin_release(&proc_lock);
 
-    struct proc *p;
-    for (p = procs; p < &procs[NPROC]; p++) {
-        spin_acquire(&p->lock);
-        if (p->state == UNUSED) {
-            goto found;
-        } else {
-            spin_release(&p->lock);
+    struct proc *p = slab_alloc(&procslab);
+    if (p == NULL) {
+        spin_acquire(&proc_lock);
+        nproc--;
+        spin_release(&proc_lock);
+        return NULL;
+    }
+    spin_init(&p->lock);
+    p->state = UNUSED;
+
+    spin_acquire(&proc_lock);
+    p->pid = _allocpid();
+    p->pidnext = pidhash[p->pid % NPIDHASH];
+    pidhash[p->pid % NPIDHASH] = p;
+    spin_release(&proc_lock);
+
+    spin_acquire(&p->lock);
+    return p;
+}
+
+// find a process by pid, NULL if there's none.
+struct proc *proc_find(uint32_t pid) {
+    spin_acquire(&proc_lock);
+    struct proc *p = _pidlookup(pid);
+    spin_release(&proc_lock);
+    return p;
+}
+
+// field of the usage of process pid, see rusage.h, pid 0 is the
+// caller. times are in ns. -1 if there's no such process or field.
+uint64_t proc_rusage(uint32_t pid, uint64_t field) {
+    struct proc *self = myproc();
+    if (field >= RU_NFIELDS) {
+        return -1;
+    }
+    if (pid == 0 || pid == self->pid) {
+        // the caller is in the kernel since its last stamp.
+        proc_charge(self, false);
+        pid = self->pid;
+    }
+    // a process running elsewhere has only been charged up to its
+    // last switch or trap.
+    spin_acquire(&proc_lock);
+    struct proc *p = _pidlookup(pid);
+    uint64_t v = p != NULL ? p->ru[field] : -1;
+    spin_release(&proc_lock);
+    if (p != NULL && (field == RU_UTIME || field == RU_STIME)) {
+        v = v * (1000000000L / TIMEBASE);
+    }
+    return v;
+}
+
+static const char *procstates[] = {
+    [UNUSED]   = "unused",
+    [SLEEPING] = "sleep",
+    [RUNNABLE] = "runnable",
+    [RUNNING]  = "run",
+    [ZOMBIE]   = "zombie",
+};
+
+// print every process and its usage on the console, one per line:
+//   ps <pid> <state> <user us> <sys us> <rss> <maxrss> <nvcsw> <nivcsw> <faults>
+// the printing may sleep, so each process is copied out under
+// proc_lock and printed after it is let go.
+void proc_dump() {
+    printf("ps-begin\n");
+    for (int i = 0; i < NPIDHASH; i++) {
+        for (int k = 0; ; k++) {
+            spin_acquire(&proc_lock);
+            struct proc *p = pidhash[i];
+            for (int j = 0; j < k && p != NULL; j++) {
+                p = p->pidnext;
+            }
+            uint32_t pid = 0;
+            enum procstate state = UNUSED;
+            uint64_t ru[RU_NFIELDS];
+            if (p != NULL) {
+                pid = p->pid;
+                state = p->state;
+                memcpy(ru, p->ru, sizeof(ru));
+            }
+            spin_release(&proc_lock);
+            if (p == NULL) {
+                break;
+            }
+            printf("ps %d %s %ld %ld %ld %ld %ld %ld %ld\n", pid, procstates[state],
+                   ru[RU_UTIME] * 1000000 / TIMEBASE, ru[RU_STIME] * 1000000 / TIMEBASE,
+                   ru[RU_RSS], ru[RU_MAXRSS], ru[RU_NVCSW], ru[RU_NIVCSW], ru[RU_NFAULT]);
         }
     }
-    return NULL;
+    printf("ps-end\n");
+}
 
-found:
-    p->pid = proc_allocpid();
+// free p, along with the memory the process itself holds.
+// called with p->lock held, never on p's own kernel stack.
+void proc_free(struct proc *p) {
+    struct pagebatch b = {0};
+    if (p->frame != NULL) {
+        pagebatchadd(&b, p->frame);
+        p->frame = NULL;
+    }
+    if (p->kstack != NULL) {
+        pagebatchadd(&b, p->kstack);
+        p->kstack = NULL;
+    }
+    if (p->pgt != NULL) {
+        pageumap(p->pgt, &b);
+        pagebatchadd(&b, p->pgt);
+        p->pgt = NULL;
+        p->ru[RU_RSS] = 0;
+        // one flush for the whole address space. the ASID goes to
+        // another process next, no hart may keep entries of this one.
+        tlbshootdown(p->cpumask, 0, 0, ASID(p));
+    }
+    // the frames are freed by an idle hart.
+    pagedefer(&b);
+    p->state = UNUSED;
 
-    if ((p->frame = (struct trapframe*)(pagezalloc(1))) == 0) {
-        spin_release(&p->lock);
-        return NULL;
+    spin_acquire(&proc_lock);
+    struct proc **pp = &pidhash[p->pid % NPIDHASH];
+    while (*pp != p) {
+        pp = &(*pp)->pidnext;
+    }
+    *pp = p->pidnext;
+    nproc--;
+    spin_release(&proc_lock);
+
+    // nobody can find p anymore.
+    spin_release(&p->lock);
+    slab_free(&procslab, p);
+}
+
+// allocate the per-cpu block of a hart other than the boot hart.
+bool cpualloc(uint64_t hart) {
+    // the block size is a multiple of the cache line, so are the
+    // offsets of the blocks the slab cuts out of a page.
+    if (cpuslab.size == 0) {
+        slab_init(&cpuslab, PERCPU_SIZE);
+    }
+    struct cpu *c = slab_alloc(&cpuslab);
+    if (c == NULL) {
+        return false;
+    }
+    c->hartid = hart;
+    // kmain() takes spinlocks in supervisor mode.
+    maprange(gettable(), (uint64_t)c, (uint64_t)c + PERCPU_SIZE, PTE_R|PTE_W);
+    cpus[hart] = c;
+    return true;
+}
+
+// give back the cpu of a hart that isn't there.
+void cpufree(uint64_t hart) {
+    struct cpu *c = cpus[hart];
+    cpus[hart] = NULL;
+    slab_free(&cpuslab, c);
+}
+
+// the first time the scheduler switches to a new process, it
+// gets here, still holding p->lock, and goes to user mode.
+static void _procret() {
+    struct proc *p = myproc();
+    spin_release(&p->lock);
+
+    uint64_t satp = build_satp(8, ASID(p), (uint64_t)p->pgt);
+    proc_charge(p, false);
+    switch_to_user((uint64_t)p->frame, p->pc, satp);
+}
+
+// a new kernel thread starts here, the function it runs is in pc
+// and its argument in a0, the same place as for user processes.
+// it runs with interrupts on, the timer preempts it like a user
+// program, except in its critical sections.
+static void _kthreadret() {
+    struct proc *p = myproc();
+    spin_release(&p->lock);
+    w_mstatus(r_mstatus() | MSTATUS_MIE);
+
+    ((void (*)(void*))p->pc)((void*)p->frame->regs[10]);
+    proc_exit();
+}
+
+// give p its kernel stack, and a context that makes the
+// scheduler start it at ret, on the top of that stack. tsize bytes
+// below it are a stack for p's traps, without them the traps are
+// handled on the kernel stack itself.
+static int _kstackalloc(struct proc *p, void (*ret)(), uint64_t tsize) {
+    if ((p->kstack = pagezalloc((tsize + KSTACK_SIZE) / PGSIZE)) == NULL) {
+        return -1;
     }
-    if ((p->stack = (uint8_t*)pagezalloc(2)) == 0) {
-        spin_release(&p->lock);
+    uint8_t *stack = p->kstack + tsize;
+    p->frame->trapstack = tsize != 0 ? stack : stack + KSTACK_SIZE;
+    *(uint64_t*)p->kstack = STACK_CANARY;
+    *(uint64_t*)stack = STACK_CANARY;
+
+    memset(&p->context, 0, sizeof(p->context));
+    p->context.ra = (uint64_t)ret;
+    p->context.sp = (uint64_t)(stack + KSTACK_SIZE);
+    return 0;
+}
+
+// whether p's kernel stack, and a kernel thread's trap stack, still
+// have their canaries.
+bool proc_stackok(struct proc *p) {
+    uint64_t tsize = p->pgt == NULL ? KTRAPSTACK_SIZE : 0;
+    return *(uint64_t*)p->kstack == STACK_CANARY &&
+           *(uint64_t*)(p->kstack + tsize) == STACK_CANARY;
+}
+
+// take an unused slot from the process table and set up a new
+// process running the ELF image bin in it.
+// if there are no free proces, or a memory allocation fails, return 0.
+struct proc* proc_alloc(uint8_t *bin, uint64_t sz) {
+    struct proc *p = _procget();
+    if (p == NULL) {
         return NULL;
     }
-    p->pc = fn_va;
+
+    if ((p->frame = (struct trapframe*)(pagezalloc(1))) == 0) {
+        goto bad;
+    }
     if ((p->pgt = (uint64_t*)pagezalloc(1)) == 0) {
-        spin_release(&p->lock);
-        return NULL;
+        goto bad;
+    }
+    if (_kstackalloc(p, _procret, 0) < 0) {
+        goto bad;
+    }
+    // the program's segments are only recorded here, its pages
+    // are mapped on demand by the page fault handler.
+    for (int i = 0; i < NVMA; i++) {
+        p->vmas[i].end = 0;
     }
-    p->state = RUNNING;
+    if (elf_load(p, bin, sz) < 0) {
+        goto bad;
+    }
+    // the stack is anonymous memory, populated on demand as well.
+    if (vma_add(p, STACK_ADDR, STACK_ADDR + STACK_SIZE, PTE_R|PTE_W, NULL, 0) < 0) {
+        goto bad;
+    }
+    setrunnable(p);
     //struct procdata data;
     //p->data = data;
 
@@ -109,54 +349,71 @@ found:
     // the sepc shows that register x2(2) is the stack pointer.
     // also need to set the stack adjustment so that it is at
     // the bottom of the memory and far away from heap allocations.
-    p->frame->regs[2] = STACK_ADDR + PGSIZE * 2;
-    printf("sp %p\n", p->frame->regs[2]);
-    pagetable_t pgt = p->pgt;
-    uint64_t pa = (uint64_t)p->stack;
-    // map the stack onto the user's virtual address. 
-    for (int i = 0; i < 2; i++) {
-        uint64_t off = i * PGSIZE;
-        pagemap(pgt, STACK_ADDR + off, pa + off, PTE_R|PTE_W|PTE_U, 0);
-    }
-
-    for (int i = 0; i < 100; i++) {
-        uint64_t modifier = i * 0x1000;
-        printf("fn");
-        pagemap(pgt, fn_va + modifier, fn_pa + modifier, PTE_R|PTE_W|PTE_X|PTE_U, 0);
-    }
-
-    // map the program counter on the MMU
-    //pagemap(pgt, STARTING, (uint64_t)fn, PTE_R|PTE_X|PTE_U, 0);
-    //pagemap(pgt, STARTING + 0x1001, (uint64_t)fn + 0x1001, PTE_R|PTE_X|PTE_U, 0);
-    printf("fn addr: %p\n", (uint64_t)fn);
-    printf("switch_to_user: 0x%x\n", (uint64_t)switch_to_user);
-    pagemap(pgt, 0x80000000, 0x80000000, PTE_U|PTE_R|PTE_X, 0);
-
-    printf("pagetable 0x%x\n", (uint64_t)pgt);
-    printf("walk 0x%x -> 0x%x\n", (uint64_t)fn, va2pa(pgt, (uint64_t)fn));
-    /*
-    printf("STACK_ADDR: walk %p -> 0x%x\n", STACK_ADDR, va2pa(pgt, STACK_ADDR));
-    printf("            walk %p -> 0x%x\n", STACK_ADDR + PGSIZE, va2pa(pgt, STACK_ADDR + PGSIZE));
-    printf("STARTING:   walk 0x%x -> 0x%x\n", STARTING, va2pa(pgt, STARTING));
-    printf("            walk 0x%x -> 0x%x\n", STARTING + 0x1001, va2pa(pgt, STARTING + 0x1001));
-    */
+    p->frame->regs[2] = STACK_ADDR + STACK_SIZE;
 
     spin_release(&p->lock);
     return p;
+
+bad:
+    proc_free(p);
+    return NULL;
+}
+
+// create a kernel thread running fn(arg) in machine mode. kernel
+// threads have no address space of their own and run until they
+// give up the hart with yield() or sleep(), return, or are preempted.
+struct proc* proc_kthread(void (*fn)(void*), void *arg) {
+    struct proc *p = _procget();
+    if (p == NULL) {
+        return NULL;
+    }
+    if ((p->frame = (struct trapframe*)(pagezalloc(1))) == 0) {
+        goto bad;
+    }
+    if (_kstackalloc(p, _kthreadret, KTRAPSTACK_SIZE) < 0) {
+        goto bad;
+    }
+    p->pgt = NULL;
+    p->pc = (uint64_t)fn;
+    p->frame->regs[10] = (uint64_t)arg;
+    setrunnable(p);
+
+    spin_release(&p->lock);
+    return p;
+
+bad:
+    proc_free(p);
+    return NULL;
+}
+
+// the current process is done and never runs again. it stays a
+// ZOMBIE until the scheduler has switched away from it and frees it.
+void proc_exit() {
+    struct proc *p = myproc();
+    spin_acquire(&p->lock);
+    p->state = ZOMBIE;
+    sched();
+    panic("zombie %d exit", p->pid);
 }
 
 // must be called with interrupts disabled
 // to prevent race with process being moved
 // to a different CPU.
 uint32_t cpuid() {
-    int id = r_tp();
-    return id;
+    return mycpu()->hartid;
+}
+
+// the process running on this hart, NULL if none. kernel threads
+// can be preempted, keep them from moving in between.
+struct proc* myproc() {
+    push_off();
+    struct proc *p = mycpu()->proc;
+    pop_off();
+    return p;
 }
 
 // return this CPU's cpu struct
 // interrupts must be disabled
 struct cpu* mycpu() {
-    int id = cpuid();
-    struct cpu *c = &cpus[id];
-    return c;
+    return (struct cpu*)r_tp();
 }
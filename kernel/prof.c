@@ -0,0 +1,154 @@
+#include "include/types.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/defs.h"
+#include "include/param.h"
+#include "include/proc.h"
+#include "include/prof.h"
+
+// the sampling profiler. while it runs, the timer interrupt also
+// fires every prof_period mtime ticks on every hart and records a
+// sample into the hart's own ring. prof_stop() prints the rings on
+// the console, tools/profsym.py turns that into folded stacks.
+
+// mtime ticks between two samples, 0 when the profiler is off.
+static volatile uint64_t prof_period;
+
+struct profring {
+    struct profsample *buf;
+    uint64_t n;         // samples taken, buf[n % PROF_RING_SIZE] is next
+    uint64_t next;      // mtime of the next sample
+};
+
+DEFINE_PER_CPU(struct profring, prof_ring);
+
+// sample hz times a second on every hart.
+void prof_start(uint64_t hz) {
+    if (hz == 0 || hz > TIMEBASE) {
+        hz = PROF_HZ;
+    }
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] != NULL) {
+            per_cpu(prof_ring, hart).n = 0;
+            per_cpu(prof_ring, hart).next = 0;
+        }
+    }
+    __sync_synchronize();
+    prof_period = TIMEBASE / hz;
+    printf("prof: sampling at %ld Hz\n", hz);
+}
+
+// when this hart's timer has to fire for the next sample,
+// -1 if the profiler is off.
+uint64_t prof_deadline(uint64_t now) {
+    struct profring *r = this_cpu_ptr(prof_ring);
+    if (prof_period == 0) {
+        return -1;
+    }
+    if (r->next == 0) {
+        r->next = now + prof_period;
+    }
+    return r->next;
+}
+
+// a plausible frame pointer on a kernel stack, at or above sp.
+static bool _fpvalid(uint64_t fp, uint64_t sp) {
+    return (fp & 7) == 0 && fp >= sp && fp >= KERNBASE && fp < PHYSTOP;
+}
+
+// walk the frame pointers of the interrupted kernel code. with
+// -fno-omit-frame-pointer, s0 points right above the saved return
+// address and the caller's s0. leaf functions don't save ra, just s0,
+// so if the first slot already looks like a frame pointer, that's
+// where we were interrupted, and ra is still in the register.
+static int _backtrace(struct trapframe *frame, uint64_t *pcs, int max) {
+    uint64_t fp = frame->regs[8];
+    uint64_t sp = frame->regs[2];
+    int n = 0;
+
+    if (_fpvalid(fp, sp) && _fpvalid(((uint64_t*)fp)[-1], fp) && n < max) {
+        pcs[n++] = frame->regs[1];
+        fp = ((uint64_t*)fp)[-1];
+    }
+    while (n < max && _fpvalid(fp, sp)) {
+        uint64_t ra = ((uint64_t*)fp)[-1];
+        uint64_t prev = ((uint64_t*)fp)[-2];
+        if (ra < KERNBASE || ra >= PHYSTOP) {
+            break;
+        }
+        pcs[n++] = ra;
+        // the stack grows down, callers' frames are higher up.
+        if (prev <= fp) {
+            break;
+        }
+        sp = fp;
+        fp = prev;
+    }
+    return n;
+}
+
+// called from the timer interrupt, record where the hart was if
+// it's time for a sample. user code is only sampled by its pc, its
+// stack is in its own address space.
+void prof_tick(uint64_t epc, uint64_t status, struct trapframe *frame) {
+    struct profring *r = this_cpu_ptr(prof_ring);
+    uint64_t now = *(uint64_t*)CLINT_MTIME;
+
+    if (prof_period == 0 || r->next == 0 || now < r->next) {
+        return;
+    }
+    r->next = now + prof_period;
+    if (r->buf == NULL && (r->buf = pagezalloc(PROF_RING_PAGES)) == NULL) {
+        return;
+    }
+
+    struct profsample *s = &r->buf[r->n % PROF_RING_SIZE];
+    s->mode = (status & MSTATUS_MPP_MASK) >> 11;
+    s->pc[0] = epc;
+    s->depth = 1;
+    if (s->mode != 0) {
+        s->depth += _backtrace(frame, &s->pc[1], PROF_DEPTH - 1);
+    }
+    r->n++;
+}
+
+// stop sampling, the samples stay for prof_dump().
+void prof_stop() {
+    prof_period = 0;
+    __sync_synchronize();
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] != NULL) {
+            per_cpu(prof_ring, hart).next = 0;
+        }
+    }
+}
+
+// print the samples of every hart, one per line:
+//   prof <hart> <mode> <pc> <return address>...
+// far more than the UART's ring holds, call it where printf can sleep.
+void prof_dump() {
+    printf("prof-begin\n");
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] == NULL) {
+            continue;
+        }
+        struct profring *r = &per_cpu(prof_ring, hart);
+        if (r->buf == NULL) {
+            continue;
+        }
+        uint64_t first = r->n > PROF_RING_SIZE ? r->n - PROF_RING_SIZE : 0;
+        for (uint64_t i = first; i < r->n; i++) {
+            struct profsample *s = &r->buf[i % PROF_RING_SIZE];
+            printf("prof %d %d", hart, s->mode);
+            for (int d = 0; d < s->depth; d++) {
+                printf(" %lx", s->pc[d]);
+            }
+            printf("\n");
+        }
+    }
+    printf("prof-end\n");
+}
+
+bool prof_running() {
+    return prof_period != 0;
+}
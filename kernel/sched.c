@@ -1,31 +1,277 @@
 #include "include/proc.h"
 #include "include/defs.h"
 #include "include/types.h"
+#include "include/perf.h"
+#include "include/trace.h"
+#include "include/riscv.h"
 
-extern struct proc procs[NPROC];
+extern void swtch(struct context *old, struct context *new);
 
-bool scheduler(uint64_t *f, uint64_t *mepc, uint64_t *satp) {
-    struct proc *p;
+// sleeping processes are kept in a hash table of wait queues, keyed
+// by the channel they sleep on, so wakeup() only has to look at the
+// few that may wait for it instead of at the whole process table.
+// processes on the same queue are linked through p->wqnext, p->chan
+// tells which of them to wake up.
+#define NWAITQ_BITS 6
+#define NWAITQ (1 << NWAITQ_BITS)
 
-    for (p = procs; p < &procs[NPROC]; p++) {
-        if (p->state == RUNNING) {
-            break;
+struct waitq {
+    struct spinlock lock;
+    struct proc *head;
+};
+
+static struct waitq waitqs[NWAITQ];
+
+static struct waitq *_waitq(void *chan) {
+    // fibonacci hashing, the top bits of the product are the best mixed.
+    uint64_t h = (uint64_t)chan * 0x9e3779b97f4a7c15UL;
+    return &waitqs[h >> (64 - NWAITQ_BITS)];
+}
+
+// RUNNABLE processes wait on a run queue in FIFO order, linked
+// through p->rqnext, so picking the next one doesn't depend on how
+// many processes there are.
+static struct spinlock rqlock;
+static struct proc *rqhead;
+static struct proc *rqtail;
+
+// make p RUNNABLE and queue it. caller holds p->lock.
+void setrunnable(struct proc *p) {
+    p->state = RUNNABLE;
+    p->rqnext = NULL;
+    spin_acquire(&rqlock);
+    if (rqtail != NULL) {
+        rqtail->rqnext = p;
+    } else {
+        rqhead = p;
+    }
+    rqtail = p;
+    spin_release(&rqlock);
+}
+
+static struct proc *_runqget() {
+    spin_acquire(&rqlock);
+    struct proc *p = rqhead;
+    if (p != NULL) {
+        rqhead = p->rqnext;
+        if (rqhead == NULL) {
+            rqtail = NULL;
         }
     }
+    spin_release(&rqlock);
+    return p;
+}
 
-    if (p == NULL) {
-        return false;
+// the per-hart scheduler, never returns. it runs in machine mode on
+// a stack of its own, takes the next RUNNABLE process off the run
+// queue and swtch()es to it. the process switches back here through
+// sched() when it yields or blocks.
+void scheduler() {
+    struct cpu *c = mycpu();
+
+    c->proc = NULL;
+    while (1) {
+        struct proc *p = _runqget();
+        if (p == NULL) {
+            // nothing to run, give back the memory of dead processes.
+            if (pagereclaim()) {
+                continue;
+            }
+            // then wait for an interrupt. they are taken in
+            // the hart's own trap frame and on its trap stack, so they
+            // don't step on the stack we are running on.
+            w_mscratch((uint64_t)&c->frame);
+            w_mstatus(r_mstatus() | MSTATUS_MIE);
+            asm volatile("wfi");
+            w_mstatus(r_mstatus() & ~MSTATUS_MIE);
+            continue;
+        }
+
+        // p may still be on its way off another hart, which lets go
+        // of p->lock once it has switched away from it.
+        spin_acquire(&p->lock);
+        p->state = RUNNING;
+        c->proc = p;
+        c->resched = false;
+        trace(TR_SCHEDIN, p->pid, 0, 0);
+
+        // traps taken while p runs land in its trap frame and
+        // on its kernel stack, in its address space.
+        p->frame->hartid = cpuid();
+        p->frame->cpu = c;
+        p->rustamp = r_time();
+        w_mscratch((uint64_t)p->frame);
+        // entries this hart still has for p's ASID are p's, no need to
+        // flush them. from now on, changes to p's mappings have to be
+        // shot down here as well. kernel threads run in machine mode,
+        // they don't translate at all.
+        if (p->pgt != NULL) {
+            w_satp(build_satp(8, ASID(p), (uint64_t)p->pgt));
+            __sync_fetch_and_or(&p->cpumask, 1UL << c->hartid);
+        } else {
+            w_satp(c->frame.satp);
+        }
+        perf_count(PERF_CTXSW);
+        swtch(&c->context, &p->context);
+
+        // p is done running for now, it changed its state
+        // and still holds its lock. if it exited, we're off its
+        // kernel stack now and can free it.
+        c->proc = NULL;
+        proc_charge(p, false);
+        trace(TR_SCHEDOUT, p->pid, p->state, 0);
+        if (p->state == ZOMBIE) {
+            proc_free(p);
+        } else {
+            spin_release(&p->lock);
+        }
     }
+}
 
-    *f = (uint64_t)p->frame;
-    *mepc = (uint64_t)p->pc;
-    *satp = (uint64_t)p->pgt;
+// hand the hart over to its scheduler. called once per hart
+// from the trap handler and never returns.
+void schedstart() {
+    struct cpu *c = mycpu();
+    struct context boot;
 
-    printf("scheduling %d\n", p->pid);
+    // from now on, all the hart runs is machine mode code.
+    c->mmode = true;
+    uint8_t *stack = pagezalloc(1);
+    if (stack == NULL) {
+        panic("hart%d: no scheduler stack", cpuid());
+    }
+    memset(&c->context, 0, sizeof(c->context));
+    c->context.ra = (uint64_t)scheduler;
+    c->context.sp = (uint64_t)(stack + PGSIZE);
+    swtch(&boot, &c->context);
+    panic("schedstart");
+}
+
+// switch back to the scheduler. the caller must hold p->lock and
+// has changed p->state already. the trap that got us here still has
+// to return through mstatus, which the harts we run on in between
+// overwrite with their own traps, so keep it. whether interrupts were
+// on before p->lock was taken belongs to p as well, not to the hart.
+void sched() {
+    struct proc *p = myproc();
 
-    if (*satp != 0) {
-        *satp = ((uint64_t)8 << 60 | ((uint64_t)p->pid << 44) | *satp);
+    if (!holding(&p->lock)) {
+        panic("sched p->lock");
+    }
+    if (p->state == RUNNING) {
+        panic("sched running");
+    }
+    if (mycpu()->noff != 1) {
+        panic("sched locks");
     }
+    if (!proc_stackok(p)) {
+        panic("sched: pid %d overran its kernel stack", p->pid);
+    }
+    // a trap handler that gets here is done for now.
+    irqtrace_trapexit();
+    uint64_t status = r_mstatus();
+    int intena = mycpu()->intena;
+    swtch(&p->context, &mycpu()->context);
+    mycpu()->intena = intena;
+    w_mstatus(status);
+}
+
+// charge the time since p's last stamp to its user or its system
+// time. p is switched to and from by the scheduler, and goes to user
+// mode and back in between with every trap.
+void proc_charge(struct proc *p, bool user) {
+    uint64_t now = r_time();
+    p->ru[user ? RU_UTIME : RU_STIME] += now - p->rustamp;
+    p->rustamp = now;
+}
+
+static void _yield(struct proc *p) {
+    spin_acquire(&p->lock);
+    setrunnable(p);
+    sched();
+    spin_release(&p->lock);
+}
 
+// a preemption point: give up the hart if the timer asked for it and
+// it isn't in a critical section. returns whether it did.
+bool preempt() {
+    struct cpu *c = mycpu();
+    if (!c->resched || c->noff > 0 || c->proc == NULL) {
+        return false;
+    }
+    c->resched = false;
+    c->proc->ru[RU_NIVCSW]++;
+    _yield(c->proc);
     return true;
-}
\ No newline at end of file
+}
+
+// a preemption point for long loops in the kernel. traps are handled
+// with interrupts off, a tick that comes due in the middle of one is
+// taken here instead of after it.
+void cond_resched() {
+    struct cpu *c = mycpu();
+    if (c->noff > 0 || c->proc == NULL) {
+        return;
+    }
+    if (r_mip() & (MIP_MTIP | MIP_STIP)) {
+        timerintr(c->hartid);
+        c->resched = true;
+    }
+    preempt();
+}
+
+// give up the hart for one scheduling round.
+void yield() {
+    struct proc *p = myproc();
+    p->ru[RU_NVCSW]++;
+    _yield(p);
+}
+
+// atomically release lk and sleep on chan, reacquires lk when
+// woken up. the hart runs something else in the meantime.
+void sleep(void *chan, struct spinlock *lk) {
+    struct proc *p = myproc();
+    struct waitq *q = _waitq(chan);
+
+    // once we hold the queue's lock, wakeup() can't miss us, it
+    // has to take it to find us, so lk can go.
+    spin_acquire(&q->lock);
+    spin_release(lk);
+
+    spin_acquire(&p->lock);
+    p->chan = chan;
+    p->state = SLEEPING;
+    p->wqnext = q->head;
+    q->head = p;
+    spin_release(&q->lock);
+
+    // wakeup() also needs p->lock to make us RUNNABLE, which the
+    // scheduler only lets go of once we are off this hart.
+    p->ru[RU_NVCSW]++;
+    sched();
+    p->chan = NULL;
+
+    spin_release(&p->lock);
+    spin_acquire(lk);
+}
+
+// wake up all processes sleeping on chan.
+void wakeup(void *chan) {
+    struct waitq *q = _waitq(chan);
+
+    spin_acquire(&q->lock);
+    struct proc **pp = &q->head;
+    while (*pp != NULL) {
+        struct proc *p = *pp;
+        if (p->chan != chan) {
+            pp = &p->wqnext;
+            continue;
+        }
+        *pp = p->wqnext;
+        p->wqnext = NULL;
+        spin_acquire(&p->lock);
+        setrunnable(p);
+        spin_release(&p->lock);
+    }
+    spin_release(&q->lock);
+}
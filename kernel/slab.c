@@ -0,0 +1,56 @@
+#include "include/types.h"
+#include "include/riscv.h"
+#include "include/defs.h"
+#include "include/slab.h"
+#include "include/perf.h"
+
+void slab_init(struct slab *s, uint64_t size) {
+    spin_init(&s->lock);
+    s->size = (size + SLAB_ALIGN - 1) & ~(uint64_t)(SLAB_ALIGN - 1);
+    s->free = NULL;
+    s->npages = 0;
+    s->nused = 0;
+    if (s->size > PGSIZE) {
+        panic("slab_init: object of %d bytes", size);
+    }
+}
+
+// cut a fresh page into objects and put them on the free list.
+// caller holds s->lock.
+static bool _slabgrow(struct slab *s) {
+    uint8_t *pg = pagealloc(1);
+    if (pg == NULL) {
+        return false;
+    }
+    for (uint64_t off = 0; off + s->size <= PGSIZE; off += s->size) {
+        *(void**)(pg + off) = s->free;
+        s->free = pg + off;
+    }
+    s->npages++;
+    return true;
+}
+
+// a zeroed object, NULL if memory runs out.
+void *slab_alloc(struct slab *s) {
+    perf_count(PERF_SLABALLOC);
+    spin_acquire(&s->lock);
+    if (s->free == NULL && !_slabgrow(s)) {
+        spin_release(&s->lock);
+        return NULL;
+    }
+    void *obj = s->free;
+    s->free = *(void**)obj;
+    s->nused++;
+    spin_release(&s->lock);
+
+    memset(obj, 0, s->size);
+    return obj;
+}
+
+void slab_free(struct slab *s, void *obj) {
+    spin_acquire(&s->lock);
+    *(void**)obj = s->free;
+    s->free = obj;
+    s->nused--;
+    spin_release(&s->lock);
+}
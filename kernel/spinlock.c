@@ -2,30 +2,65 @@
 #include "include/defs.h"
 #include "include/riscv.h"
 #include "include/proc.h"
+#include "include/irqtrace.h"
 
 
 bool holding(struct spinlock *lk) {
     return lk->locked && lk->cpu == mycpu();
 }
 
+// the interrupts that matter are the machine mode ones, except in
+// kmain(), which runs in supervisor mode and can't touch mstatus.
+static int _intr_get(struct cpu *c) {
+    if (c->mmode) {
+        return (r_mstatus() & MSTATUS_MIE) != 0;
+    }
+    return intr_get();
+}
+
+static void _intr_off(struct cpu *c) {
+    if (c->mmode) {
+        w_mstatus(r_mstatus() & ~MSTATUS_MIE);
+    } else {
+        intr_off();
+    }
+}
+
+static void _intr_on(struct cpu *c) {
+    if (c->mmode) {
+        w_mstatus(r_mstatus() | MSTATUS_MIE);
+    } else {
+        intr_on();
+    }
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes tow pop_off() to undo two push_off(), also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
-void push_off() {
-    int old = intr_get();
+// kernel threads run with interrupts on and can be preempted, so only
+// the cpu we look at once they are off is the one we stay on.
+// site is who to blame for the time interrupts stay off.
+static void _push_off(uint64_t site) {
+    int old = _intr_get(mycpu());
+    _intr_off(mycpu());
 
     struct cpu *c = mycpu();
-
-    intr_off();
     if (c->noff == 0) {
         c->intena = old;
+        if (old) {
+            irqtrace_pushoff(site);
+        }
     }
     c->noff += 1;
 }
 
+void push_off() {
+    _push_off((uint64_t)__builtin_return_address(0));
+}
+
 void pop_off() {
     struct cpu *c = mycpu();
-    if (intr_get()) {
+    if (_intr_get(c)) {
         panic("pop_off: interruptiable");
     }
     if (c->noff < 1) {
@@ -33,19 +68,26 @@ void pop_off() {
     }
     c->noff -= 1;
     if (c->noff == 0 && c->intena) {
-        intr_on();
+        irqtrace_popoff();
+        // the end of the outermost critical section of a kernel thread
+        // is a preemption point, for a switch the timer asked for
+        // while it couldn't be done.
+        preempt();
+        _intr_on(mycpu());
     }
 }
 
 void spin_init(struct spinlock *lk) {
     lk->locked = false;
     lk->cpu = NULL;
+    lk->tstart = 0;
 }
 
 // acquire the lock
 // loops until the lock is acquired
 void spin_acquire(struct spinlock *lk) {
-    push_off(); // disable interrupts to avoid deadlock
+    uint64_t site = (uint64_t)__builtin_return_address(0);
+    _push_off(site); // disable interrupts to avoid deadlock
     if (holding(lk)) {
         panic("acquire");
     }
@@ -54,8 +96,9 @@ void spin_acquire(struct spinlock *lk) {
     // a5 = 1
     // s1 = &lk->locked
     // amoswap.w.aq a5, a5, (s1)
+    // the holder may be waiting for us to flush our TLB, see tlb.c.
     while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
-        ;
+        tlbpoll();
 
     // tell the C ompiler and the processor to not move loads or stores
     // past this point, to ensure that the critical section's memory
@@ -64,6 +107,8 @@ void spin_acquire(struct spinlock *lk) {
     __sync_synchronize();
 
     lk->cpu = mycpu();
+    lk->tstart = irqtrace_now();
+    lk->site = site;
 }
 
 // release the lock
@@ -72,6 +117,7 @@ void spin_release(struct spinlock *lk) {
         panic("release");
     }
 
+    irqtrace_record(IRQT_LOCK, lk->tstart, lk->site, (uint64_t)lk);
     lk->cpu = NULL;
 
     // tell the C compiler and the CPU to not move loads or stores
@@ -0,0 +1,209 @@
+#include "include/defs.h"
+#include "include/types.h"
+#include "include/cpu.h"
+
+// memory and string routines used all over the kernel, the compiler
+// also emits calls to memset/memcpy for struct copies and clears.
+//
+// the generic versions below work a doubleword at a time once the
+// pointers are aligned, unrolled eight times so each iteration moves
+// a 64-byte cache line. misaligned doubleword accesses may trap or be
+// emulated, so buffers that can't be aligned together go byte by byte.
+// harts with the vector extension use the RVV versions in vstring.S,
+// memset/memcpy/memmove are patched to jump there once at boot.
+//
+// the bodies are inlined into both the public functions, which get
+// patched, and the *_generic ones, which never are, so the benchmark
+// can still compare the two.
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+ALWAYS_INLINE void *_memset(void *dst, int c, uint64_t n) {
+    uint8_t *d = (uint8_t*)dst;
+    while (n > 0 && ((uint64_t)d & 7)) {
+        *d++ = c;
+        n--;
+    }
+
+    // replicate the byte into every byte of a doubleword.
+    uint64_t v = (uint8_t)c;
+    v |= v << 8;
+    v |= v << 16;
+    v |= v << 32;
+    uint64_t *w = (uint64_t*)d;
+    for (; n >= 64; n -= 64, w += 8) {
+        w[0] = v;
+        w[1] = v;
+        w[2] = v;
+        w[3] = v;
+        w[4] = v;
+        w[5] = v;
+        w[6] = v;
+        w[7] = v;
+    }
+    for (; n >= 8; n -= 8) {
+        *w++ = v;
+    }
+
+    d = (uint8_t*)w;
+    while (n > 0) {
+        *d++ = c;
+        n--;
+    }
+    return dst;
+}
+
+ALWAYS_INLINE void *_memcpy(void *dst, const void *src, uint64_t n) {
+    uint8_t *d = (uint8_t*)dst;
+    const uint8_t *s = (const uint8_t*)src;
+    if ((((uint64_t)d ^ (uint64_t)s) & 7) == 0) {
+        while (n > 0 && ((uint64_t)d & 7)) {
+            *d++ = *s++;
+            n--;
+        }
+        uint64_t *wd = (uint64_t*)d;
+        const uint64_t *ws = (const uint64_t*)s;
+        for (; n >= 64; n -= 64, wd += 8, ws += 8) {
+            // all loads before the stores, so memmove can use this
+            // for forward copies of overlapping buffers.
+            uint64_t a0 = ws[0], a1 = ws[1], a2 = ws[2], a3 = ws[3];
+            uint64_t a4 = ws[4], a5 = ws[5], a6 = ws[6], a7 = ws[7];
+            wd[0] = a0;
+            wd[1] = a1;
+            wd[2] = a2;
+            wd[3] = a3;
+            wd[4] = a4;
+            wd[5] = a5;
+            wd[6] = a6;
+            wd[7] = a7;
+        }
+        for (; n >= 8; n -= 8) {
+            *wd++ = *ws++;
+        }
+        d = (uint8_t*)wd;
+        s = (const uint8_t*)ws;
+    }
+    while (n > 0) {
+        *d++ = *s++;
+        n--;
+    }
+    return dst;
+}
+
+ALWAYS_INLINE void *_memmove(void *dst, const void *src, uint64_t n) {
+    uint8_t *d = (uint8_t*)dst;
+    const uint8_t *s = (const uint8_t*)src;
+    if (d <= s || d >= s + n) {
+        // copying forward never overwrites bytes still to be read.
+        return _memcpy(dst, src, n);
+    }
+
+    // dst overlaps the end of src, copy backwards.
+    d += n;
+    s += n;
+    if ((((uint64_t)d ^ (uint64_t)s) & 7) == 0) {
+        while (n > 0 && ((uint64_t)d & 7)) {
+            *--d = *--s;
+            n--;
+        }
+        uint64_t *wd = (uint64_t*)d;
+        const uint64_t *ws = (const uint64_t*)s;
+        for (; n >= 64; n -= 64) {
+            wd -= 8;
+            ws -= 8;
+            uint64_t a0 = ws[0], a1 = ws[1], a2 = ws[2], a3 = ws[3];
+            uint64_t a4 = ws[4], a5 = ws[5], a6 = ws[6], a7 = ws[7];
+            wd[7] = a7;
+            wd[6] = a6;
+            wd[5] = a5;
+            wd[4] = a4;
+            wd[3] = a3;
+            wd[2] = a2;
+            wd[1] = a1;
+            wd[0] = a0;
+        }
+        for (; n >= 8; n -= 8) {
+            *--wd = *--ws;
+        }
+        d = (uint8_t*)wd;
+        s = (const uint8_t*)ws;
+    }
+    while (n > 0) {
+        *--d = *--s;
+        n--;
+    }
+    return dst;
+}
+
+PATCHABLE void *memset(void *dst, int c, uint64_t n) {
+    return _memset(dst, c, n);
+}
+
+PATCHABLE void *memcpy(void *dst, const void *src, uint64_t n) {
+    return _memcpy(dst, src, n);
+}
+
+PATCHABLE void *memmove(void *dst, const void *src, uint64_t n) {
+    return _memmove(dst, src, n);
+}
+
+void *memset_generic(void *dst, int c, uint64_t n) {
+    return _memset(dst, c, n);
+}
+
+void *memcpy_generic(void *dst, const void *src, uint64_t n) {
+    return _memcpy(dst, src, n);
+}
+
+void *memmove_generic(void *dst, const void *src, uint64_t n) {
+    return _memmove(dst, src, n);
+}
+
+// the RVV loops in vstring.S keep their state in the vector registers,
+// which nothing saves. a trap in the middle of one, or a switch to
+// another kernel thread, could run other vector code that overwrites
+// them, so they run with interrupts off and without preemption, a
+// chunk at a time to keep the time with interrupts off short.
+#define RVV_CHUNK (64 * 1024)
+
+void *memset_rvv_loop(void *dst, int c, uint64_t n);
+void *memcpy_rvv_loop(void *dst, const void *src, uint64_t n);
+void *memmove_rvv_loop(void *dst, const void *src, uint64_t n);
+
+void *memset_rvv(void *dst, int c, uint64_t n) {
+    for (uint64_t off = 0; off < n; off += RVV_CHUNK) {
+        push_off();
+        memset_rvv_loop((uint8_t*)dst + off, c, n - off < RVV_CHUNK ? n - off : RVV_CHUNK);
+        pop_off();
+    }
+    return dst;
+}
+
+void *memcpy_rvv(void *dst, const void *src, uint64_t n) {
+    for (uint64_t off = 0; off < n; off += RVV_CHUNK) {
+        push_off();
+        memcpy_rvv_loop((uint8_t*)dst + off, (const uint8_t*)src + off,
+                        n - off < RVV_CHUNK ? n - off : RVV_CHUNK);
+        pop_off();
+    }
+    return dst;
+}
+
+// an overlapping move towards higher addresses goes chunk by chunk
+// from the end, so no chunk overwrites source bytes of one still to
+// be moved.
+void *memmove_rvv(void *dst, const void *src, uint64_t n) {
+    bool backwards = (uint8_t*)dst > (const uint8_t*)src &&
+                     (uint8_t*)dst < (const uint8_t*)src + n;
+    for (uint64_t done = 0; done < n; done += RVV_CHUNK) {
+        uint64_t len = n - done < RVV_CHUNK ? n - done : RVV_CHUNK;
+        uint64_t off = backwards ? n - done - len : done;
+        push_off();
+        memmove_rvv_loop((uint8_t*)dst + off, (const uint8_t*)src + off, len);
+        pop_off();
+    }
+    return dst;
+}
+
+ALTERNATIVE(memset, memset_rvv, CPU_V);
+ALTERNATIVE(memcpy, memcpy_rvv, CPU_V);
+ALTERNATIVE(memmove, memmove_rvv, CPU_V);
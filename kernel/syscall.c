@@ -1,9 +1,22 @@
 #include "include/trap.h"
 #include "include/types.h"
 #include "include/defs.h"
+#include "include/memlayout.h"
+#include "include/perf.h"
+#include "include/trace.h"
+#include "include/proc.h"
+
+// a system call runs in a trap handler, which would have to drop most
+// of the samples' lines, a kernel thread prints them.
+static void _profdump(void *arg) {
+    prof_dump();
+}
 
 uint64_t do_syscall(uint64_t mepc, struct trapframe *frame) {
     uint64_t sysno = frame->regs[10];
+    perf_count(PERF_SYSCALL);
+    // only processes make syscalls, the frame is the one of the running one.
+    trace(TR_SYSCALL, sysno, frame->cpu->proc->pid, frame->regs[11]);
     switch (sysno)
     {
     case 0:
@@ -12,7 +25,39 @@ uint64_t do_syscall(uint64_t mepc, struct trapframe *frame) {
     case 1:
         printf("test syscall\n");
         mepc += 4;
-    
+        break;
+    case 2:
+        // nanosleep(ns), the hart runs something else meanwhile.
+        mepc += 4;
+        timersleep(*(uint64_t*)CLINT_MTIME + frame->regs[11] * (TIMEBASE / 1000000) / 1000);
+        frame->regs[10] = 0;
+        break;
+    case 3:
+        // perf(event), see perf.h for the events.
+        mepc += 4;
+        frame->regs[10] = perf_read(frame->regs[11]);
+        break;
+    case 4:
+        // profile(hz) starts the sampling profiler, profile(0) stops
+        // it and has the samples printed.
+        mepc += 4;
+        frame->regs[10] = 0;
+        if (frame->regs[11] != 0) {
+            prof_start(frame->regs[11]);
+        } else {
+            prof_stop();
+            if (proc_kthread(_profdump, NULL) == NULL) {
+                frame->regs[10] = -1;
+            }
+        }
+        break;
+    case 5:
+        // getrusage(pid, field), see rusage.h for the fields.
+        // pid 0 is the caller.
+        mepc += 4;
+        frame->regs[10] = proc_rusage(frame->regs[11], frame->regs[12]);
+        break;
+
     default:
         printf("unknown syscall number %d\n", sysno);
         break;
@@ -0,0 +1,185 @@
+#include "../include/defs.h"
+#include "../include/memlayout.h"
+#include "../include/riscv.h"
+#include "../include/types.h"
+#include "../include/spinlock.h"
+#include "../include/proc.h"
+#include "../include/page.h"
+
+// microbenchmarks of the kernel's hot paths. every benchmark runs its
+// operation iters times per sample, a few samples are thrown away to
+// warm up the caches and TLB, and the rest are sorted for the median
+// and the 99th percentile. the results are printed one per line
+// between bench-begin and bench-end:
+//   bench <name> <iters> <median ns> <p99 ns> <median cycles>
+// all numbers are per operation. a median of 0 (the clock didn't
+// move) or above the benchmark's limit fails the run, qemu exits
+// with EXIT_FAIL. the limits are far above what qemu's TCG takes,
+// they catch what is broken, not what got a bit slower. they run in
+// a kernel thread, after the scheduler is up, see kinit(). the string
+// routines are measured and checked first, by stringbench().
+#define BENCH_WARMUP 5
+#define BENCH_SAMPLES 101
+
+struct bench {
+	const char *name;
+	uint64_t iters;
+	void (*fn)(uint64_t iters);
+	uint64_t limit; // ns per operation
+};
+
+static void _benchpagealloc(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		pagedealloc(pagealloc(1));
+	}
+}
+
+static void _benchkmalloc(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		kfree(kmalloc(64));
+	}
+}
+
+// a scratch table of its own, so the kernel's mappings stay untouched.
+// all pages go into the same level 0 table, only the first one has to
+// allocate the intermediate tables. they all map the table itself,
+// PTE_SHARED keeps pageumap() from freeing it.
+static pagetable_t scratch;
+
+static void _benchpagemap(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		uint64_t va = STACK_ADDR + (i % 512) * PGSIZE;
+		pagemap(scratch, va, (uint64_t)scratch, PTE_R|PTE_W|PTE_SHARED, 0);
+	}
+}
+
+static struct spinlock benchlock;
+
+static void _benchspinlock(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		spin_acquire(&benchlock);
+		spin_release(&benchlock);
+	}
+}
+
+// syscall 0 does nothing, so this is the trap path plus the dispatch.
+// kernel threads call into do_syscall() just like user programs.
+static void _benchsyscall(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		register uint64_t a0 asm("a0") = 0;
+		asm volatile("ecall" : "+r"(a0) : : "memory");
+	}
+}
+
+// m_trap() steps over a breakpoint in kernel code, the cheapest way
+// in and out of the trap handler.
+static void _benchtrap(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		asm volatile("ebreak" : : : "memory");
+	}
+}
+
+// setting up the next tick, the compare register is a CSR with Sstc
+// and MMIO in the CLINT without it.
+static void _benchtimerarm(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		push_off();
+		timerinit(cpuid());
+		pop_off();
+	}
+}
+
+// a partner thread keeps yielding as well, so every yield switches to
+// the scheduler and into the next thread on the run queue.
+static volatile bool pingpong;
+
+static void _yielder(void *arg) {
+	while (pingpong) {
+		yield();
+	}
+}
+
+static void _benchyield(uint64_t iters) {
+	for (uint64_t i = 0; i < iters; i++) {
+		yield();
+	}
+}
+
+static struct bench benches[] = {
+	{"pagealloc", 1000, _benchpagealloc, 100000},
+	{"kmalloc", 1000, _benchkmalloc, 100000},
+	{"pagemap", 100, _benchpagemap, 1000000},
+	{"spinlock", 10000, _benchspinlock, 100000},
+	{"syscall", 1000, _benchsyscall, 1000000},
+	{"trap", 1000, _benchtrap, 1000000},
+	{"timerarm", 1000, _benchtimerarm, 1000000},
+	{"yield", 10, _benchyield, 10000000},
+};
+
+static void _sort(uint64_t *v, int n) {
+	for (int i = 1; i < n; i++) {
+		uint64_t x = v[i];
+		int j = i;
+		for (; j > 0 && v[j - 1] > x; j--) {
+			v[j] = v[j - 1];
+		}
+		v[j] = x;
+	}
+}
+
+// run b, print its results and tell whether they are sane.
+static bool _benchrun(struct bench *b) {
+	uint64_t ticks[BENCH_SAMPLES];
+	uint64_t cycles[BENCH_SAMPLES];
+
+	for (int i = 0; i < BENCH_WARMUP; i++) {
+		b->fn(b->iters);
+	}
+	for (int i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = r_time();
+		uint64_t c0 = r_mcycle();
+		b->fn(b->iters);
+		cycles[i] = r_mcycle() - c0;
+		ticks[i] = r_time() - t0;
+	}
+	_sort(ticks, BENCH_SAMPLES);
+	_sort(cycles, BENCH_SAMPLES);
+
+	uint64_t median = ticks[BENCH_SAMPLES / 2] * 1000000000L / TIMEBASE;
+	uint64_t p99 = ticks[BENCH_SAMPLES * 99 / 100] * 1000000000L / TIMEBASE;
+	printf("bench %s %ld %ld %ld %ld\n", b->name, b->iters,
+	       median / b->iters, p99 / b->iters, cycles[BENCH_SAMPLES / 2] / b->iters);
+	if (ticks[BENCH_SAMPLES / 2] == 0 || median / b->iters > b->limit) {
+		printf("bench-fail %s: median %ld ns, limit %ld ns\n",
+		       b->name, median / b->iters, b->limit);
+		return false;
+	}
+	return true;
+}
+
+void bench(void *arg) {
+	if ((scratch = pagezalloc(1)) == NULL) {
+		panic("bench: no free memory");
+	}
+	spin_init(&benchlock);
+	pingpong = true;
+	if (proc_kthread(_yielder, NULL) == NULL) {
+		panic("bench: can't start the yield partner");
+	}
+
+	stringbench();
+
+	bool ok = true;
+	printf("bench-begin\n");
+	for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		ok &= _benchrun(&benches[i]);
+	}
+	printf("bench-end\n");
+
+	pingpong = false;
+	struct pagebatch b = {0};
+	pageumap(scratch, &b);
+	pagebatchadd(&b, scratch);
+	pagedeallocbatch(&b);
+	poweroff(ok ? EXIT_PASS : EXIT_FAIL);
+}
@@ -0,0 +1,63 @@
+#ifndef RVOS_HOST_H
+#define RVOS_HOST_H
+
+// force-included (-include) into every file of the host test build,
+// ahead of the kernel's own headers. the headers below are claimed
+// by defining their include guards, and what page.c and kmem.c need
+// from them is defined here for the host instead: the host's own
+// integer types, and no-ops for the privileged instructions.
+#define RVOS_TYPES_H
+#define RVOS_RISCV_H
+#define RVOS_PERF_H
+#define RVOS_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t pde_t;
+
+// riscv.h
+#define PGSIZE 4096 // bytes per page
+#define PGSHIFT 12  // bits of offset within a page
+
+#define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
+#define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
+
+#define PTE_V (1L << 0)
+#define PTE_R (1L << 1)
+#define PTE_W (1L << 2)
+#define PTE_X (1L << 3)
+#define PTE_U (1L << 4)
+#define PTE_SHARED (1L << 8)
+
+#define PA2PTE(pa) ((((uint64_t)pa) >> 12) << 10)
+#define PTE2PA(pte) (((pte) >> 10) << 12)
+#define PTE_FLAGS(pte) ((pte) & 0x3FF)
+
+#define PXMASK          0x1FF // 9 bits
+#define PXSHIFT(level)  (PGSHIFT+(9*(level)))
+#define PX(level, va) ((((uint64_t) (va)) >> PXSHIFT(level)) & PXMASK)
+
+#define MAXVA (1L << (9 + 9 + 9 + 12 - 1))
+
+typedef uint64_t pte_t;
+typedef uint64_t *pagetable_t; // 512 PTEs
+
+#define AllocFlag ((uint64_t)1<<63)
+
+#define RREG(addr) (*(volatile uint32_t*)(addr))
+#define WREG(addr, val) (*(volatile uint32_t*)(addr) = val)
+
+// there's no TLB to flush, and the alternatives are never patched in.
+static inline void satp_fence_asid(uint64_t x) {}
+static inline void sfence_vma_page(uint64_t va, uint64_t asid) {}
+static inline void cbo_zero(void *addr) {}
+
+// perf.h
+#define perf_count(ev) ((void)0)
+
+// trace.h
+#define trace(ev, a0, a1, a2) ((void)0)
+
+#endif // RVOS_HOST_H
@@ -0,0 +1,413 @@
+// the page allocator (page.c) and the kernel heap (kmem.c) built for
+// the host and run against a fake heap from mmap(). see `make hosttest`.
+//
+//   hosttest [seed [ops]]
+//
+// the page allocator is fuzzed differentially: a model of it, a plain
+// first-fit map plus the pool of zeroed pages, predicts the exact
+// address of every allocation and the real allocator has to agree.
+// the kernel heap is checked for what callers rely on, aligned, in
+// bounds, not overlapping and whole again once everything is freed.
+// both are benchmarked at the end.
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "../../include/defs.h"
+#include "../../include/memlayout.h"
+
+// what page.c and kmem.c get from the rest of the kernel.
+uint64_t HEAP_START;
+uint64_t HEAP_SIZE;
+uint64_t cbozero_size = 64;
+
+static bool verbose;
+
+int kprintf(const char *s, ...) {
+	if (!verbose) {
+		return 0;
+	}
+	va_list vl;
+	va_start(vl, s);
+	int n = vprintf(s, vl);
+	va_end(vl);
+	return n;
+}
+
+void panic(const char *s, ...) {
+	va_list vl;
+	va_start(vl, s);
+	fprintf(stderr, "panic: ");
+	vfprintf(stderr, s, vl);
+	fprintf(stderr, "\n");
+	va_end(vl);
+	abort();
+}
+
+void assert(bool flag) {
+	if (!flag) {
+		panic("assert false");
+	}
+}
+
+void spin_init(struct spinlock *lk) {}
+void spin_acquire(struct spinlock *lk) {}
+void spin_release(struct spinlock *lk) {}
+void cond_resched() {}
+
+#define HOST_HEAP_SIZE (16 * 1024 * 1024)
+
+// kmeminit() takes this many pages for the heap, it's
+// the whole of what kmalloc() hands out.
+#define KMEM_PAGES 512
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+		return; \
+	} \
+} while (0)
+
+// xorshift, the runs have to be reproducible from the seed.
+static uint64_t rngstate;
+
+static uint64_t rng() {
+	rngstate ^= rngstate << 13;
+	rngstate ^= rngstate >> 7;
+	rngstate ^= rngstate << 17;
+	return rngstate;
+}
+
+static uint64_t nsnow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+//////////////////////////////////
+// PAGE ALLOCATOR MODEL
+//////////////////////////////////
+
+// same as ZPOOL_SIZE in page.c.
+#define MODEL_ZPOOL 64
+
+static uint8_t *model;   // 1 where a page is taken
+static uint64_t npages;
+static uint64_t model_pool[MODEL_ZPOOL];
+static int model_pooln;
+
+static uint64_t _pgaddr(uint64_t i) {
+	return getallocstart() + i * PGSIZE;
+}
+
+static uint64_t _pgindex(void *pa) {
+	return ((uint64_t)pa - getallocstart()) / PGSIZE;
+}
+
+// first fit, like _pagealloc(). -1 if there's no room.
+static int64_t _modelfit(int np) {
+	uint64_t run = 0;
+	for (uint64_t i = 0; i < npages; i++) {
+		run = model[i] ? 0 : run + 1;
+		if (run == np) {
+			return i + 1 - np;
+		}
+	}
+	return -1;
+}
+
+static void _modeltake(int64_t i, int np) {
+	memset(model + i, 1, np);
+}
+
+static void *_modelalloc(int np) {
+	int64_t i = _modelfit(np);
+	if (i < 0 && model_pooln > 0) {
+		while (model_pooln > 0) {
+			model[_pgindex((void*)model_pool[--model_pooln])] = 0;
+		}
+		i = _modelfit(np);
+	}
+	if (i < 0) {
+		return NULL;
+	}
+	_modeltake(i, np);
+	return (void*)_pgaddr(i);
+}
+
+static void *_modelzalloc(int np) {
+	if (np == 1 && model_pooln > 0) {
+		return (void*)model_pool[--model_pooln];
+	}
+	return _modelalloc(np);
+}
+
+static bool _modelpoolfill() {
+	if (model_pooln == MODEL_ZPOOL) {
+		return false;
+	}
+	int64_t i = _modelfit(1);
+	if (i < 0) {
+		return false;
+	}
+	_modeltake(i, 1);
+	model_pool[model_pooln++] = _pgaddr(i);
+	return true;
+}
+
+//////////////////////////////////
+// PAGE ALLOCATOR FUZZER
+//////////////////////////////////
+
+struct pgalloc {
+	uint8_t *pa;
+	int np;
+	uint8_t fill;
+};
+
+#define MAXLIVE 256
+static struct pgalloc live[MAXLIVE];
+static int nlive;
+
+static bool _iszero(uint8_t *p, uint64_t n) {
+	for (uint64_t i = 0; i < n; i++) {
+		if (p[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool _isfilled(uint8_t *p, uint64_t n, uint8_t c) {
+	for (uint64_t i = 0; i < n; i++) {
+		if (p[i] != c) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// the allocations made by pageinit() and kmeminit() go into the
+// model first, they have to land where the model puts them.
+static void _modelinit() {
+	npages = pagecount();
+	model = calloc(npages, 1);
+	model_pooln = 0;
+	if (_modelalloc(1) != getzeropage() ||
+	    _modelalloc(KMEM_PAGES) != (void*)gethead() ||
+	    _modelalloc(1) != (void*)gettable()) {
+		fprintf(stderr, "FAIL: boot allocations differ from the model\n");
+		failures++;
+	}
+}
+
+static void _pagefuzzop(uint64_t op) {
+	uint64_t r = rng();
+	if (r % 8 == 0) {
+		bool got = pagezpoolfill();
+		bool want = _modelpoolfill();
+		CHECK(got == want, "op %lu: pagezpoolfill() %d, model %d", op, got, want);
+		return;
+	}
+	if (nlive > 0 && (nlive == MAXLIVE || r % 8 < 4)) {
+		int k = rng() % nlive;
+		struct pgalloc a = live[k];
+		CHECK(_isfilled(a.pa, a.np * PGSIZE, a.fill),
+		      "op %lu: %d pages at %p were overwritten", op, a.np, a.pa);
+		pagedealloc((struct page*)a.pa);
+		memset(model + _pgindex(a.pa), 0, a.np);
+		live[k] = live[--nlive];
+		return;
+	}
+
+	// mostly small allocations, now and then one that may not fit.
+	int np = r % 8 == 7 ? 1 + rng() % (npages / 4) : 1 + rng() % 8;
+	bool zero = rng() % 2;
+	uint8_t *got = zero ? pagezalloc(np) : pagealloc(np);
+	uint8_t *want = zero ? _modelzalloc(np) : _modelalloc(np);
+	CHECK(got == want, "op %lu: page%salloc(%d) = %p, model %p",
+	      op, zero ? "z" : "", np, got, want);
+	if (got == NULL) {
+		return;
+	}
+	CHECK(!zero || _iszero(got, np * PGSIZE), "op %lu: pagezalloc(%d) = %p isn't zeroed", op, np, got);
+	struct pgalloc a = {got, np, (uint8_t)(1 + op % 255)};
+	memset(a.pa, a.fill, np * PGSIZE);
+	live[nlive++] = a;
+}
+
+static void pagefuzz(uint64_t ops) {
+	for (uint64_t op = 0; op < ops && failures == 0; op++) {
+		_pagefuzzop(op);
+	}
+	while (nlive > 0) {
+		struct pgalloc a = live[--nlive];
+		pagedealloc((struct page*)a.pa);
+		memset(model + _pgindex(a.pa), 0, a.np);
+	}
+	printf("pagefuzz: %lu ops, %s\n", ops, failures ? "FAIL" : "ok");
+}
+
+//////////////////////////////////
+// KERNEL HEAP FUZZER
+//////////////////////////////////
+
+struct kalloc {
+	uint8_t *p;
+	uint64_t sz;
+	uint8_t fill;
+};
+
+static struct kalloc klive[MAXLIVE];
+static int nklive;
+
+static void _kmemfuzzop(uint64_t op) {
+	uint64_t r = rng();
+	uint8_t *start = (uint8_t*)gethead();
+	uint8_t *end = start + KMEM_PAGES * PGSIZE;
+
+	if (nklive > 0 && (nklive == MAXLIVE || r % 2 == 0)) {
+		int k = rng() % nklive;
+		struct kalloc a = klive[k];
+		CHECK(_isfilled(a.p, a.sz, a.fill),
+		      "op %lu: kmalloc(%lu) at %p was overwritten", op, a.sz, a.p);
+		kfree(a.p);
+		klive[k] = klive[--nklive];
+		return;
+	}
+
+	uint64_t sz = r % 16 == 0 ? rng() % (64 * 1024) : rng() % 256;
+	bool zero = rng() % 2;
+	uint8_t *p = zero ? kzmalloc(sz) : kmalloc(sz);
+	if (p == NULL) {
+		return;
+	}
+	CHECK(((uint64_t)p & 7) == 0, "op %lu: kmalloc(%lu) = %p isn't aligned", op, sz, p);
+	CHECK(p >= start && p + sz <= end, "op %lu: kmalloc(%lu) = %p is outside of the heap", op, sz, p);
+	for (int i = 0; i < nklive; i++) {
+		CHECK(p + sz <= klive[i].p || klive[i].p + klive[i].sz <= p,
+		      "op %lu: kmalloc(%lu) = %p overlaps %p", op, sz, p, klive[i].p);
+	}
+	CHECK(!zero || _iszero(p, sz), "op %lu: kzmalloc(%lu) = %p isn't zeroed", op, sz, p);
+	struct kalloc a = {p, sz, (uint8_t)(1 + op % 255)};
+	memset(p, a.fill, sz);
+	klive[nklive++] = a;
+}
+
+static void kmemfuzz(uint64_t ops) {
+	for (uint64_t op = 0; op < ops && failures == 0; op++) {
+		_kmemfuzzop(op);
+	}
+	while (nklive > 0) {
+		kfree(klive[--nklive].p);
+	}
+	// with everything freed, the heap has to be in one piece again.
+	uint64_t all = KMEM_PAGES * PGSIZE - 8;
+	uint8_t *p = kmalloc(all);
+	if (p == NULL) {
+		fprintf(stderr, "FAIL: kmalloc(%lu) after freeing everything\n", all);
+		failures++;
+	} else {
+		kfree(p);
+	}
+	printf("kmemfuzz: %lu ops, %s\n", ops, failures ? "FAIL" : "ok");
+}
+
+//////////////////////////////////
+// BENCHMARKS
+//////////////////////////////////
+
+#define BENCH_OPS 100000
+
+static void _report(const char *name, uint64_t start, uint64_t ops) {
+	printf("hostbench %s %lu ns/op\n", name, (nsnow() - start) / ops);
+}
+
+static void hostbench() {
+	uint64_t start = nsnow();
+	for (int i = 0; i < BENCH_OPS; i++) {
+		pagedealloc(pagealloc(1));
+	}
+	_report("pagealloc1", start, BENCH_OPS);
+
+	start = nsnow();
+	for (int i = 0; i < BENCH_OPS; i++) {
+		pagedealloc(pagealloc(16));
+	}
+	_report("pagealloc16", start, BENCH_OPS);
+
+	// the same with the low pages taken, the search has to skip them.
+	void *hold[1024];
+	for (int i = 0; i < 1024; i++) {
+		hold[i] = pagealloc(1);
+	}
+	start = nsnow();
+	for (int i = 0; i < BENCH_OPS; i++) {
+		pagedealloc(pagealloc(1));
+	}
+	_report("pagealloc1_busy", start, BENCH_OPS);
+	for (int i = 0; i < 1024; i++) {
+		pagedealloc(hold[i]);
+	}
+
+	start = nsnow();
+	for (int i = 0; i < BENCH_OPS; i++) {
+		kfree(kmalloc(64));
+	}
+	_report("kmalloc64", start, BENCH_OPS);
+
+	// a fragmented heap, every other chunk taken.
+	uint8_t *chunks[1024];
+	for (int i = 0; i < 1024; i++) {
+		chunks[i] = kmalloc(32 + rng() % 96);
+	}
+	for (int i = 0; i < 1024; i += 2) {
+		kfree(chunks[i]);
+	}
+	start = nsnow();
+	for (int i = 0; i < BENCH_OPS / 10; i++) {
+		kfree(kmalloc(128));
+	}
+	_report("kmalloc128_fragmented", start, BENCH_OPS / 10);
+	for (int i = 1; i < 1024; i += 2) {
+		kfree(chunks[i]);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : (uint64_t)time(NULL);
+	uint64_t ops = argc > 2 ? strtoull(argv[2], NULL, 0) : 100000;
+	verbose = getenv("HOSTTEST_VERBOSE") != NULL;
+	rngstate = seed ? seed : 1;
+	printf("hosttest: seed %lu\n", seed);
+
+	// the page structures at the start of the heap have to be page
+	// aligned, just like in the kernel, mmap() gives us that.
+	void *heap = mmap(NULL, HOST_HEAP_SIZE, PROT_READ|PROT_WRITE,
+	                  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (heap == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	HEAP_START = (uint64_t)heap;
+	HEAP_SIZE = HOST_HEAP_SIZE;
+
+	pageinit(HEAP_START + HEAP_SIZE);
+	kmeminit();
+	_modelinit();
+
+	pagefuzz(ops);
+	kmemfuzz(ops);
+	if (failures == 0) {
+		hostbench();
+	}
+	return failures ? 1 : 0;
+}
@@ -5,7 +5,7 @@
 void largealloc() {
 	printf("\nlargealloc test start...\n");
 	// allocate maximum number of pages
-	int num = PGROUNDDOWN(HEAP_START + HEAP_SIZE - getallocstart()) / PGSIZE;
+	int num = pagecount();
 	printf("try to alloc %d pages\n", num);
 	void *ptr1 = pagealloc(num-1);
 	if (ptr1 == NULL) {
@@ -24,7 +24,7 @@ void largealloc() {
 
 void halfalloc() {
 	printf("\nhalfalloc test start....\n");
-	int num = PGROUNDDOWN(HEAP_START + HEAP_SIZE - getallocstart()) / PGSIZE;
+	int num = pagecount();
 	printf("try to alloc %d pages\n", num / 2 + 10);
 	void *ptr1 = pagealloc(num / 2 + 10);
 	if (ptr1 == NULL) {
@@ -75,7 +75,7 @@ void havedealloc() {
 void largescale() {
 	printf("\nlargescale test: start...\n");
 
-	int num = PGROUNDDOWN(HEAP_START + HEAP_SIZE - getallocstart()) / PGSIZE;
+	int num = pagecount();
 	void *ptr = NULL;
 	for (int i = 1; i <= 1000; i++) {
 		if (i % 2 == 1) {
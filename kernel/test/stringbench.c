@@ -0,0 +1,118 @@
+#include "../include/defs.h"
+#include "../include/memlayout.h"
+#include "../include/riscv.h"
+#include "../include/types.h"
+
+// compare the throughput of the memory routines at a small copy,
+// one page and one megapage. every run moves the same total amount of
+// data, so the small sizes show the per-call overhead.
+#define BENCH_TOTAL (16 * 1024 * 1024)
+#define BENCH_MAX (2 * 1024 * 1024)
+
+typedef void *(*setfn)(void*, int, uint64_t);
+typedef void *(*copyfn)(void*, const void*, uint64_t);
+
+// MiB per second for n bytes moved in the given number of mtime ticks.
+static uint64_t _throughput(uint64_t n, uint64_t ticks) {
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	return n * TIMEBASE / ticks / (1024 * 1024);
+}
+
+// the routines are checked as well as timed, a fast copy that gets
+// the bytes wrong is no good.
+static void _checkbytes(const char *name, const uint8_t *got, const uint8_t *want, int c, uint64_t size) {
+	for (uint64_t i = 0; i < size; i++) {
+		if (got[i] != (want != NULL ? want[i] : (uint8_t)c)) {
+			panic("stringbench: %s %d B is wrong at byte %d", name, size, i);
+		}
+	}
+}
+
+static uint64_t _benchset(const char *name, setfn fn, uint8_t *dst, uint64_t size) {
+	uint64_t reps = BENCH_TOTAL / size;
+	fn(dst, 0, size); // warm up
+	uint64_t start = r_time();
+	for (uint64_t i = 0; i < reps; i++) {
+		fn(dst, i, size);
+	}
+	uint64_t ticks = r_time() - start;
+	_checkbytes(name, dst, NULL, reps - 1, size);
+	uint64_t mibs = _throughput(reps * size, ticks);
+	printf("stringbench: %s %d B: %d MiB/s\n", name, size, mibs);
+	return mibs;
+}
+
+static uint64_t _benchcopy(const char *name, copyfn fn, uint8_t *dst, uint8_t *src, uint64_t size) {
+	uint64_t reps = BENCH_TOTAL / size;
+	fn(dst, src, size); // warm up
+	uint64_t start = r_time();
+	for (uint64_t i = 0; i < reps; i++) {
+		fn(dst, src, size);
+	}
+	uint64_t ticks = r_time() - start;
+	if (dst + size <= src || src + size <= dst) {
+		_checkbytes(name, dst, src, 0, size);
+	}
+	uint64_t mibs = _throughput(reps * size, ticks);
+	printf("stringbench: %s %d B: %d MiB/s\n", name, size, mibs);
+	return mibs;
+}
+
+// how much faster the RVV version is, in tenths.
+static void _speedup(const char *name, uint64_t size, uint64_t generic, uint64_t rvv) {
+	uint64_t x10 = generic != 0 ? rvv * 10 / generic : 0;
+	printf("stringbench: %s %d B: rvv %d.%dx generic\n", name, size, x10 / 10, x10 % 10);
+}
+
+static void _checkcopy(copyfn fn, const char *name) {
+	uint8_t buf[64];
+	for (int i = 0; i < 64; i++) {
+		buf[i] = i;
+	}
+	// overlapping move towards the end of the buffer.
+	fn(buf + 3, buf, 50);
+	for (int i = 0; i < 50; i++) {
+		if (buf[i + 3] != i) {
+			panic("stringbench: %s overlapping copy is wrong", name);
+		}
+	}
+}
+
+void stringbench() {
+	printf("\nstringbench start...\n");
+	uint8_t *src = pagealloc(BENCH_MAX / PGSIZE);
+	uint8_t *dst = pagealloc(BENCH_MAX / PGSIZE);
+	if (src == NULL || dst == NULL) {
+		panic("stringbench: no free memory");
+	}
+	bool rvv = (r_misa() & MISA_V) != 0;
+
+	_checkcopy(memmove_generic, "memmove_generic");
+	if (rvv) {
+		_checkcopy(memmove_rvv, "memmove_rvv");
+	}
+
+	for (uint64_t i = 0; i < BENCH_MAX; i++) {
+		src[i] = i * 7;
+	}
+
+	uint64_t sizes[] = {64, PGSIZE, BENCH_MAX};
+	for (int i = 0; i < 3; i++) {
+		uint64_t size = sizes[i];
+		uint64_t set = _benchset("memset_generic", memset_generic, dst, size);
+		uint64_t cpy = _benchcopy("memcpy_generic", memcpy_generic, dst, src, size);
+		uint64_t mov = _benchcopy("memmove_generic", memmove_generic, dst + 8, dst, size - 8);
+		if (rvv) {
+			_speedup("memset", size, set, _benchset("memset_rvv", memset_rvv, dst, size));
+			_speedup("memcpy", size, cpy, _benchcopy("memcpy_rvv", memcpy_rvv, dst, src, size));
+			_speedup("memmove", size - 8, mov,
+			         _benchcopy("memmove_rvv", memmove_rvv, dst + 8, dst, size - 8));
+		}
+	}
+
+	pagedealloc((void*)src);
+	pagedealloc((void*)dst);
+	printf("stringbench: done\n\n");
+}
@@ -0,0 +1,112 @@
+#include "include/types.h"
+#include "include/memlayout.h"
+#include "include/riscv.h"
+#include "include/defs.h"
+#include "include/proc.h"
+#include "include/spinlock.h"
+#include "include/cpu.h"
+#include "include/percpu.h"
+
+// every hart has its own compare register in the CLINT, the timer
+// interrupt fires once mtime gets past it. it drives scheduling
+// and ends timed sleeps. harts with Sstc have a stimecmp CSR instead,
+// which is much cheaper to write than the CLINT's MMIO register.
+
+// processes in a timed sleep, sorted by the time they wake up,
+// linked through p->tnext.
+static struct spinlock tlock;
+static struct proc *timers;
+
+// the deadline the hart's compare register is set to, so it can be
+// checked without reading the register back.
+DEFINE_PER_CPU(uint64_t, timer_next);
+
+// mtime, through the time CSR rather than the CLINT.
+static uint64_t _mtime() {
+    return r_time();
+}
+
+// set the calling hart's compare register.
+PATCHABLE void timercmp(uint64_t hart, uint64_t t) {
+    *(uint64_t*)CLINT_MTIMECMP(hart) = t;
+}
+
+// the supervisor timer interrupt it raises is taken in machine mode
+// like the CLINT's, as cause 5 instead of 7.
+void timercmp_sstc(uint64_t hart, uint64_t t) {
+    w_stimecmp(t);
+}
+
+ALTERNATIVE(timercmp, timercmp_sstc, CPU_SSTC);
+
+static void _timerset(uint64_t hart, uint64_t t) {
+    this_cpu(timer_next) = t;
+    timercmp(hart, t);
+}
+
+// fire the hart's next timer interrupt at the scheduling tick, or
+// earlier if a timed sleep ends or the profiler samples before that.
+static void _timerarm(uint64_t hart, uint64_t now) {
+    uint64_t next = now + TICK;
+    uint64_t sample = prof_deadline(now);
+    if (sample < next) {
+        next = sample;
+    }
+    spin_acquire(&tlock);
+    if (timers != NULL && timers->sleep_until < next) {
+        next = timers->sleep_until;
+    }
+    spin_release(&tlock);
+    _timerset(hart, next);
+}
+
+void timerinit(uint64_t hart) {
+    _timerarm(hart, _mtime());
+}
+
+// the timer interrupt: wake up the processes whose sleep is over
+// and set the next interrupt.
+void timerintr(uint64_t hart) {
+    uint64_t now = _mtime();
+
+    spin_acquire(&tlock);
+    while (timers != NULL && timers->sleep_until <= now) {
+        struct proc *p = timers;
+        timers = p->tnext;
+        p->tnext = NULL;
+        p->sleep_until = 0;
+        wakeup(&p->sleep_until);
+    }
+    spin_release(&tlock);
+
+    _timerarm(hart, now);
+}
+
+// put the current process to sleep until mtime reaches until.
+void timersleep(uint64_t until) {
+    struct proc *p = myproc();
+
+    if (until <= _mtime()) {
+        return;
+    }
+    spin_acquire(&tlock);
+    uint64_t hart = cpuid();
+    struct proc **pp = &timers;
+    while (*pp != NULL && (*pp)->sleep_until <= until) {
+        pp = &(*pp)->tnext;
+    }
+    p->sleep_until = until;
+    p->tnext = *pp;
+    *pp = p;
+    // the first one to wake up, make sure this hart's timer
+    // doesn't fire too late for it.
+    if (timers == p && until < this_cpu(timer_next)) {
+        _timerset(hart, until);
+    }
+
+    // timerintr() takes us off the list before waking us up.
+    while (p->sleep_until != 0) {
+        sleep(&p->sleep_until, &tlock);
+    }
+    spin_release(&tlock);
+}
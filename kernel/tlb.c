@@ -0,0 +1,127 @@
+#include "include/types.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/defs.h"
+#include "include/param.h"
+#include "include/proc.h"
+#include "include/perf.h"
+
+// TLB shootdown. a hart can only flush its own TLB, so when a mapping
+// that other harts may have cached changes, they are asked to flush
+// it themselves: the request goes into their mailbox and a software
+// interrupt (MSIP) makes them look at it. the sender waits until all
+// of them are done, only then can the old page be reused.
+//
+// the mailbox is a bounded queue with many senders and one receiver,
+// without a lock: every slot carries a sequence number that says
+// whose turn it is. a sender claims the slot at head when its seq is
+// head, fills it in and publishes it with seq = head + 1. the owner
+// takes the slot at tail once seq is tail + 1, and hands it back to
+// the senders with seq = tail + TLB_MBOX.
+#define TLB_MBOX 16
+
+struct tlbreq {
+    volatile uint64_t seq;
+    uint64_t va;
+    uint64_t np;          // 0 for the whole address space
+    uint64_t asid;
+    volatile int *pending; // the sender's count of harts still flushing
+};
+
+struct tlbmbox {
+    volatile uint64_t head;
+    uint64_t tail;
+    struct tlbreq req[TLB_MBOX];
+};
+
+DEFINE_PER_CPU(struct tlbmbox, tlb_mbox);
+
+void tlbinithart() {
+    struct tlbmbox *m = this_cpu_ptr(tlb_mbox);
+    for (int i = 0; i < TLB_MBOX; i++) {
+        m->req[i].seq = i;
+    }
+}
+
+static void _tlbflush(uint64_t va, uint64_t np, uint64_t asid) {
+    if (np == 0) {
+        perf_count(PERF_TLBFENCE);
+        satp_fence_asid(asid);
+    } else {
+        pageflush(va, np, asid);
+    }
+}
+
+// handle the requests in this hart's mailbox. called from the software
+// interrupt, and by harts that wait with interrupts off, so two harts
+// shooting at each other don't wait for each other forever.
+void tlbpoll() {
+    struct tlbmbox *m = this_cpu_ptr(tlb_mbox);
+    while (1) {
+        struct tlbreq *r = &m->req[m->tail % TLB_MBOX];
+        if (r->seq != m->tail + 1) {
+            break;
+        }
+        __sync_synchronize();
+        _tlbflush(r->va, r->np, r->asid);
+        __sync_fetch_and_sub(r->pending, 1);
+        __sync_synchronize();
+        r->seq = m->tail + TLB_MBOX;
+        m->tail++;
+    }
+}
+
+static void _tlbpost(uint64_t hart, uint64_t va, uint64_t np, uint64_t asid,
+                     volatile int *pending) {
+    struct tlbmbox *m = &per_cpu(tlb_mbox, hart);
+    while (1) {
+        uint64_t pos = m->head;
+        struct tlbreq *r = &m->req[pos % TLB_MBOX];
+        if (r->seq == pos) {
+            if (__sync_bool_compare_and_swap(&m->head, pos, pos + 1)) {
+                r->va = va;
+                r->np = np;
+                r->asid = asid;
+                r->pending = pending;
+                __sync_synchronize();
+                r->seq = pos + 1;
+                return;
+            }
+        } else if (r->seq < pos) {
+            // full, the owner hasn't got to its mailbox yet.
+            tlbpoll();
+        }
+    }
+}
+
+// flush np pages at va in address space asid on every hart in mask,
+// this one included, and return once they all have. np 0 flushes all
+// of asid. every hart gets a single request and a single interrupt
+// for the whole range, however many pages it covers.
+void tlbshootdown(uint64_t mask, uint64_t va, uint64_t np, uint64_t asid) {
+    uint64_t self = cpuid();
+    volatile int pending = 0;
+    uint64_t sent = 0;
+
+    for (uint64_t hart = 0; hart < NCPU; hart++) {
+        if (hart == self || !(mask & (1UL << hart)) || cpus[hart] == NULL) {
+            continue;
+        }
+        __sync_fetch_and_add(&pending, 1);
+        _tlbpost(hart, va, np, asid, &pending);
+        sent |= 1UL << hart;
+    }
+    __sync_synchronize();
+    for (uint64_t hart = 0; hart < NCPU; hart++) {
+        if (sent & (1UL << hart)) {
+            WREG(CLINT_MSIP(hart), 1);
+        }
+    }
+
+    if (mask & (1UL << self)) {
+        _tlbflush(va, np, asid);
+    }
+    while (pending > 0) {
+        tlbpoll();
+    }
+}
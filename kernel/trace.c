@@ -0,0 +1,92 @@
+#include "include/types.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/defs.h"
+#include "include/param.h"
+#include "include/proc.h"
+#include "include/trace.h"
+
+// static tracepoints. trace() calls sit at the scheduler, the trap
+// handlers, the syscalls, the page allocator and the PLIC. while an
+// event is on, every hit writes a fixed-size record into the hart's
+// own ring, see trace.h for what the arguments are.
+//
+// trace_stop() prints the rings on the console, one record a line:
+//   trace <hart> <time> <event> <a0> <a1> <a2>
+// all in hex. trace_start() prints where the rings are, they can also
+// be read straight out of memory, e.g. with pmemsave in the qemu
+// monitor. tools/tracedump.py turns either into a timeline.
+
+volatile uint64_t trace_mask;
+
+struct tracering {
+    struct tracerec *buf;
+    uint64_t n;          // records written, buf[n % TRACE_RING_SIZE] is next
+};
+
+DEFINE_PER_CPU(struct tracering, trace_ring);
+
+void trace_emit(enum trace_event ev, uint64_t a0, uint64_t a1, uint64_t a2) {
+    // a kernel thread must not move to another hart halfway.
+    push_off();
+    struct tracering *r = this_cpu_ptr(trace_ring);
+    if (r->buf != NULL) {
+        struct tracerec *t = &r->buf[r->n % TRACE_RING_SIZE];
+        t->time = r_time();
+        t->event = ev;
+        t->a0 = a0;
+        t->a1 = a1;
+        t->a2 = a2;
+        r->n++;
+    }
+    pop_off();
+}
+
+// record the events in mask on every hart, from an empty ring.
+void trace_start(uint64_t mask) {
+    trace_mask = 0;
+    __sync_synchronize();
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] == NULL) {
+            continue;
+        }
+        struct tracering *r = &per_cpu(trace_ring, hart);
+        if (r->buf == NULL && (r->buf = pagezalloc(TRACE_RING_PAGES)) == NULL) {
+            printf("trace: no memory for hart%d's ring\n", hart);
+            return;
+        }
+        r->n = 0;
+        printf("trace: hart%d ring at 0x%lx, %ld records\n",
+               hart, (uint64_t)r->buf, TRACE_RING_SIZE);
+    }
+    __sync_synchronize();
+    trace_mask = mask & ((1UL << TR_NEVENTS) - 1);
+    printf("trace: on, events 0x%lx\n", trace_mask);
+}
+
+// stop tracing and print the records of every hart, oldest first.
+void trace_stop() {
+    trace_mask = 0;
+    __sync_synchronize();
+
+    printf("trace-begin\n");
+    for (int hart = 0; hart < NCPU; hart++) {
+        if (cpus[hart] == NULL) {
+            continue;
+        }
+        struct tracering *r = &per_cpu(trace_ring, hart);
+        if (r->buf == NULL) {
+            continue;
+        }
+        uint64_t first = r->n > TRACE_RING_SIZE ? r->n - TRACE_RING_SIZE : 0;
+        for (uint64_t i = first; i < r->n; i++) {
+            struct tracerec *t = &r->buf[i % TRACE_RING_SIZE];
+            printf("trace %d %lx %x %x %lx %lx\n", hart, t->time, t->event, t->a0, t->a1, t->a2);
+        }
+    }
+    printf("trace-end\n");
+}
+
+bool trace_running() {
+    return trace_mask != 0;
+}
@@ -3,26 +3,77 @@
 #include "include/types.h"
 #include "include/memlayout.h"
 #include "include/defs.h"
+#include "include/proc.h"
+#include "include/perf.h"
+#include "include/prof.h"
+#include "include/irqtrace.h"
+#include "include/trace.h"
 
-extern void switch_to_user(uint64_t frame, uint64_t mepc, uint64_t satp);
+// the console commands print far more than the UART's ring holds,
+// they run in a kernel thread of their own, which can sleep until
+// the line has taken the output. an interrupt handler would have to
+// drop it.
+static void _consolecmd(void *arg) {
+    switch ((uint64_t)arg)
+    {
+    case 16:
+        // ctrl-p dumps the performance counters.
+        perf_dump();
+        break;
+    case 20:
+        // ctrl-t starts the profiler, or stops it and dumps the samples.
+        if (prof_running()) {
+            prof_stop();
+            prof_dump();
+        } else {
+            prof_start(PROF_HZ);
+        }
+        break;
+    case 12:
+        // ctrl-l starts the irqsoff tracer, or stops it and dumps
+        // the worst offenders.
+        if (irqtrace_on) {
+            irqtrace_stop();
+        } else {
+            irqtrace_start();
+        }
+        break;
+    case 5:
+        // ctrl-e starts recording all the tracepoints, or stops
+        // and dumps the records.
+        if (trace_running()) {
+            trace_stop();
+        } else {
+            trace_start(~0UL);
+        }
+        break;
+    case 21:
+        // ctrl-u lists the processes and what they have used.
+        proc_dump();
+        break;
+    }
+}
 
-void external_interrupt() {
+void external_interrupt(uint64_t hart) {
     // machine external (interrupt from PLIC).
     // check the next interrupt, if the interrupt isn't vailable,
     // get zere, however, that would mean we got a suprious interupt,
     // unless get an interrupt from non-PLIC source. this is the main
     // reason that the PLIC hardwires the id 0 to 0. so that use is as an error.
-    uint32_t interrupt = plic_next();
+    uint32_t interrupt = plic_next(hart);
     if (interrupt == 0) {
         return;
     }
+    trace(TR_PLIC, interrupt, hart, 0);
     int val = 0;
     switch (interrupt) {
     // got an interrupt from the claim register, the PLIC will automatically
     // prioritize the next interrupt, so when get from claim, it will
     // be the next in priority order.
     case 10:
-        // interrupt 10 is the UART interrupt.
+        // interrupt 10 is the UART interrupt, either the transmitter
+        // is ready for more output or there's input.
+        uartintr();
         // we would typically set this to be handled out of the interrupt context.
         // but we're testing here.
         val = uartgetc();
@@ -31,6 +82,15 @@ void external_interrupt() {
         }
         switch (val)
         {
+        case 5:
+        case 12:
+        case 16:
+        case 20:
+        case 21:
+            if (proc_kthread(_consolecmd, (void*)(uint64_t)val) == NULL) {
+                printf("console: no memory for the command\n");
+            }
+            break;
         case 8:
             // this is backspace, so write a space and backup again.
             printf("%c %c", (char)(val), (char)(val));
@@ -51,9 +111,97 @@ void external_interrupt() {
     }
     // We've claimed it, so now say that we've handled it. This resets the interrupt pending
 	// and allows the UART to interrupt again. Otherwise, the UART will get "stuck".
-    plic_complete(interrupt);
+    plic_complete(hart, interrupt);
+}
+
+// count an interrupt, ev, and the cycles from the trap vector to its
+// handler, the event right after it.
+static void _irqentry(struct trapframe *frame, enum perf_sw_event ev) {
+    perf_count(PERF_TRAP);
+    perf_count(ev);
+    this_cpu(perf_sw)[ev + 1] += r_mcycle() - frame->entry;
+}
+
+// a process's time in user mode ends with a trap, and its time in
+// the kernel with the return to user mode.
+static void _rucharge(uint64_t status, bool user) {
+    if ((status & MSTATUS_MPP_MASK) == MSTATUS_MPP_U && mycpu()->proc != NULL) {
+        proc_charge(mycpu()->proc, user);
+    }
+}
+
+// a trap handler starts.
+static void _trapenter(uint64_t epc, uint64_t tval, uint64_t cause, uint64_t status) {
+    _rucharge(status, true);
+    irqtrace_trapenter(epc, cause);
+    trace(TR_TRAP, (cause & 0xfff) | (cause & ASYNC_BIT ? 1UL << 31 : 0), epc, tval);
 }
 
+// the way back out of a trap is a preemption point. a kernel thread
+// that was switched away from during the trap, here or sleeping in a
+// syscall like nanosleep, may come back on another hart. the tp it
+// returns with must be that hart's.
+static void _trapret(uint64_t status, struct trapframe *frame) {
+    irqtrace_trapexit();
+    preempt();
+    if ((status & MSTATUS_MPP_MASK) == MSTATUS_MPP_M) {
+        frame->regs[4] = r_tp();
+    }
+    _rucharge(status, false);
+}
+
+// the interrupts have their own entries in the vector table (swtch.S),
+// which call these directly.
+
+// the software interrupt. its entry only saves the caller-saved
+// registers, it must not switch to another context.
+void m_soft(struct trapframe *frame) {
+    uint64_t hart = frame->hartid;
+    uint64_t status = r_mstatus();
+    _trapenter(r_mepc(), 0, ASYNC_BIT | 3, status);
+    _irqentry(frame, PERF_SOFTIRQ);
+    // clear the pending bit, or we trap again right away.
+    WREG(CLINT_MSIP(hart), 0);
+    // another hart changed mappings we may have cached.
+    tlbpoll();
+    // the pool's hart also gets one from pagezalloc() when the
+    // pool of pre-zeroed pages runs low, top it up again, and
+    // from pagedefer() when an address space was torn down.
+    if (hart == pagezpoolgethart()) {
+        pagereclaim();
+        while (pagezpoolfill())
+            ;
+    }
+    irqtrace_trapexit();
+    _rucharge(status, false);
+}
+
+// the machine timer, or the supervisor timer on harts with Sstc.
+uint64_t m_timer(uint64_t epc, uint64_t tval, uint64_t cause, uint64_t hart,
+                 uint64_t status, struct trapframe *frame) {
+    _trapenter(epc, tval, cause, status);
+    _irqentry(frame, PERF_TIMERIRQ);
+    prof_tick(epc, status, frame);
+    timerintr(hart);
+    // give the hart to the next process, we come back here
+    // when it's our turn again, maybe on another hart. a kernel
+    // thread in a critical section runs with interrupts off, it
+    // never gets here.
+    cpus[hart]->resched = true;
+    _trapret(status, frame);
+    return epc;
+}
+
+uint64_t m_external(uint64_t epc, uint64_t tval, uint64_t cause, uint64_t hart,
+                    uint64_t status, struct trapframe *frame) {
+    _trapenter(epc, tval, cause, status);
+    _irqentry(frame, PERF_EXTIRQ);
+    external_interrupt(hart);
+    _trapret(status, frame);
+    return epc;
+}
+
+// exceptions, and interrupts without an entry of their own.
 uint64_t m_trap(uint64_t epc, uint64_t tval, uint64_t cause, uint64_t hart, 
                 uint64_t status, struct trapframe *frame) {
     // handle all traps in machine mode. RISC-V lets us delegate
@@ -66,59 +214,76 @@ uint64_t m_trap(uint64_t epc, uint64_t tval, uint64_t cause, uint64_t hart,
     uint64_t cause_num = cause & 0xfff;
     uint64_t ret_pc = epc;
     if (is_async) {
+        // only reached with mtvec in direct mode. the handlers enter
+        // and leave the trap themselves, as they do from their stubs.
         switch (cause_num)
         {
         case 3:
-            printf("Machine software interrupt CPU%d\n", hart);
-            break;
+            m_soft(frame);
+            return epc;
+        case 5:
         case 7:
-            printf("timer interrupt\n");
-            uint64_t f, m, s;
-            scheduler(&f, &m, &s);
-            *(uint32_t*)CLINT_MTIMECMP(hart) = *(uint32_t*)CLINT_MTIME + 10000000;
-            switch_to_user(f, m, s);
-            break;
+            return m_timer(epc, tval, cause, hart, status, frame);
         case 11:
-            external_interrupt();
-            //printf("Machine external interrupt CPU%d\n", hart);
-            break;
+            return m_external(epc, tval, cause, hart, status, frame);
         default:
+            _trapenter(epc, tval, cause, status);
             panic("Unhandled async trap CPU%d -> cause 0x%x\n", hart, cause);
             break;
         }
     } else {
+        _trapenter(epc, tval, cause, status);
+        perf_count(PERF_TRAP);
         switch (cause_num)
         {
         case 2:
+            if ((status & MSTATUS_MPP_MASK) == MSTATUS_MPP_U && cpus[hart]->proc != NULL) {
+                printf("pid %d: illegal instruction at 0x%x, killed\n", cpus[hart]->proc->pid, epc);
+                proc_exit();
+            }
             panic("Illegal instruction CPU%d -> 0x%x, 0x%x, cause 0x%x\n", hart, epc, tval, cause);
             break;
+        case 3:
+            // a breakpoint in the kernel without a debugger attached,
+            // step over it, it's either ebreak or c.ebreak.
+            if ((status & MSTATUS_MPP_MASK) == MSTATUS_MPP_M) {
+                ret_pc += (*(uint16_t*)epc & 3) == 3 ? 4 : 2;
+                break;
+            }
+            panic("Breakpoint CPU%d -> 0x%x\n", hart, epc);
+            break;
         case 8:
-            printf("Ecall from user mode! CPU%d ->0x%x\n", hart, epc);
-            ret_pc += do_syscall(ret_pc, frame);
+            ret_pc = do_syscall(ret_pc, frame);
             break;
         case 9:
-            printf("Ecall from supervisor mode! CPU%d -> 0x%x\n", hart, epc);
+            // kmain() is done, the hart belongs to the scheduler now.
+            schedstart();
             break;
         case 11:
-            panic("Ecall from machine mode! CPU%d ->0x%x\n", hart, epc);
+            // kernel threads make system calls the same way as
+            // user programs do.
+            if (cpus[hart]->proc == NULL) {
+                panic("Ecall from machine mode! CPU%d ->0x%x\n", hart, epc);
+            }
+            ret_pc = do_syscall(ret_pc, frame);
             break;
         case 12:
-            //printf("Instruction page fault CPU%d -> 0x%x: 0x%x\n", hart, epc, tval);
-            while (1) 
-                ;
-            ret_pc += 4;
-            break;
         case 13:
-            while (1) 
-                ;
-            printf("Load page fault CPU%d -> 0x%x: 0x%x\n", hart, epc, tval);
-            ret_pc += 4;
-            break;
         case 15:
-            while (1) 
-                ;
-            printf("Store page fault CPU%d -> 0x%x: 0x%x\n", hart, epc, tval);
-            ret_pc += 4;
+            perf_count(PERF_PGFAULT);
+            // user pages are populated lazily, a fault inside one of the
+            // process's areas just needs the page mapped and the
+            // instruction retried.
+            // a bad access from user mode only takes the process down.
+            if ((status & MSTATUS_MPP_MASK) == MSTATUS_MPP_U && cpus[hart]->proc != NULL) {
+                if (vma_fault(cpus[hart]->proc, tval, cause_num) == 0) {
+                    break;
+                }
+                printf("pid %d: page fault at 0x%x -> 0x%x, cause %d, killed\n",
+                       cpus[hart]->proc->pid, epc, tval, cause_num);
+                proc_exit();
+            }
+            panic("Page fault CPU%d -> 0x%x: 0x%x, cause %d\n", hart, epc, tval, cause_num);
             break;
         default:
             panic("Unhandled sync trap CPU%d -> %d\n", hart, cause_num);
@@ -126,5 +291,6 @@ uint64_t m_trap(uint64_t epc, uint64_t tval, uint64_t cause, uint64_t hart,
         }
     }
 
+    _trapret(status, frame);
     return ret_pc;
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 #include "include/riscv.h"
 #include "include/memlayout.h"
 #include "include/defs.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/perf.h"
 
 // UART control resigters are memory-mapped at
 // address UART0. This macro returns the address
@@ -93,10 +96,104 @@ void uartinit() {
     printf("uart init...\n");
 }
 
-int uartputc(char ch) {
+// output is queued in a ring buffer and handed to the UART whenever
+// its transmit holding register is empty, the rest goes out from the
+// transmit interrupt, so writers don't wait for the line. with the
+// ring full, a process sleeps until the interrupt has made room.
+#define UART_TX_BUF_SIZE 256
+static struct spinlock uart_tx_lock;
+static char uart_tx_buf[UART_TX_BUF_SIZE];
+static uint64_t uart_tx_w; // next byte to queue goes to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
+static uint64_t uart_tx_r; // next byte to send is uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
+// a panic's message goes out whatever it takes.
+static volatile bool uart_panicked;
+
+// give the UART as many queued bytes as it takes right now.
+// the caller holds uart_tx_lock.
+static void _uartstart() {
+    uint64_t r = uart_tx_r;
+    while (uart_tx_w != uart_tx_r && (ReadReg(LSR) & LSR_TX_IDLE)) {
+        WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
+        uart_tx_r++;
+    }
+    if (uart_tx_r != r) {
+        wakeup(&uart_tx_r);
+    }
+}
+
+// what a writer does when the ring is full, wait for room by sleeping
+// or by driving the line itself, or drop the byte. the caller holds
+// uart_tx_lock and nothing else.
+enum uartfull { TX_SLEEP, TX_SPIN, TX_DROP };
+
+static enum uartfull _uartfull() {
+    struct cpu *c = mycpu();
+    // a process that had interrupts on can sleep.
+    if (c->proc != NULL && c->noff == 1 && c->intena) {
+        return TX_SLEEP;
+    }
+    // before the scheduler, or on the way down, the hart has nothing
+    // better to do, and the output is all there is to see.
+    if (!c->mmode || uart_panicked) {
+        return TX_SPIN;
+    }
+    // trap handlers, the scheduler and code holding locks can't wait.
+    return TX_DROP;
+}
+
+static void _uartputcsync(char ch) {
     while ((ReadReg(LSR) & LSR_TX_IDLE) == 0)
         ;
-    return WriteReg(THR, ch);
+    WriteReg(THR, ch);
+}
+
+int uartputc(char ch) {
+    // a trap taken in the middle of printing on this hart prints as
+    // well (supervisor mode can't mask machine interrupts), don't wait
+    // for our own lock then, the byte just jumps the queue.
+    if (holding(&uart_tx_lock)) {
+        _uartputcsync(ch);
+        return 0;
+    }
+    spin_acquire(&uart_tx_lock);
+    while (uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE) {
+        enum uartfull how = _uartfull();
+        if (how == TX_SLEEP) {
+            sleep(&uart_tx_r, &uart_tx_lock);
+        } else if (how == TX_SPIN) {
+            _uartstart();
+        } else {
+            perf_count(PERF_UARTDROP);
+            spin_release(&uart_tx_lock);
+            return -1;
+        }
+    }
+    uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = ch;
+    uart_tx_w++;
+    _uartstart();
+    spin_release(&uart_tx_lock);
+    return 0;
+}
+
+// the UART interrupted, keep sending what's queued.
+void uartintr() {
+    spin_acquire(&uart_tx_lock);
+    _uartstart();
+    spin_release(&uart_tx_lock);
+}
+
+// from now on writers wait for the line rather than drop output.
+void uartpanic() {
+    uart_panicked = true;
+}
+
+// push out everything queued, e.g. before the hart stops for good.
+void uartflush() {
+    spin_acquire(&uart_tx_lock);
+    while (uart_tx_w != uart_tx_r) {
+        _uartstart();
+    }
+    spin_release(&uart_tx_lock);
 }
 
 void uartputs(char *s) {
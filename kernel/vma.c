@@ -0,0 +1,148 @@
+#include "include/proc.h"
+#include "include/defs.h"
+
+// record a new area [start, end) in p's address space.
+// return 0 on success, -1 if it overlaps an existing area
+// or there is no free slot left.
+int vma_add(struct proc *p, uint64_t start, uint64_t end, uint64_t perm,
+            uint8_t *src, uint64_t filesz) {
+    struct vma *free = NULL;
+    for (struct vma *v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->end == 0) {
+            if (free == NULL) {
+                free = v;
+            }
+        } else if (PGROUNDDOWN(start) < PGROUNDUP(v->end) &&
+                   PGROUNDDOWN(v->start) < PGROUNDUP(end)) {
+            // two areas can't share a page, because a page has
+            // only one set of permissions.
+            return -1;
+        }
+    }
+    if (free == NULL) {
+        return -1;
+    }
+
+    free->start = start;
+    free->end = end;
+    free->perm = perm;
+    free->src = src;
+    free->filesz = filesz;
+    return 0;
+}
+
+// find the area of p that contains va.
+struct vma *vma_find(struct proc *p, uint64_t va) {
+    for (struct vma *v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->end != 0 && va >= PGROUNDDOWN(v->start) && va < v->end) {
+            return v;
+        }
+    }
+    return NULL;
+}
+
+// a page can be mapped straight out of the image if the process can
+// never write it and every byte of the area inside the page comes
+// from the image (i.e. no zero-filled tail).
+bool _vmashared(struct vma *v, uint64_t page) {
+    if (v->perm & PTE_W) {
+        return false;
+    }
+    if (v->src == NULL) {
+        return false;
+    }
+    uint64_t fileend = v->start + v->filesz;
+    return page + PGSIZE <= fileend || v->end <= fileend;
+}
+
+// a page is anonymous if none of its bytes come from the image.
+bool _vmaanon(struct vma *v, uint64_t page) {
+    return v->src == NULL || page >= v->start + v->filesz;
+}
+
+// resident pages are the frames p has mapped, the shared zero page
+// doesn't count, it only stands in for a page p doesn't have yet.
+static bool _vmaresident(pte_t pte) {
+    return PTE2PA(pte) != (uint64_t)getzeropage();
+}
+
+static void _vmarss(struct proc *p, int64_t delta) {
+    p->ru[RU_RSS] += delta;
+    if (p->ru[RU_RSS] > p->ru[RU_MAXRSS]) {
+        p->ru[RU_MAXRSS] = p->ru[RU_RSS];
+    }
+}
+
+// handle a page fault at va for process p.
+// cause is the mcause number: 12 (instruction), 13 (load) or 15 (store).
+// return 0 if the page is now mapped and the instruction can be retried,
+// -1 if the access is not allowed.
+int vma_fault(struct proc *p, uint64_t va, uint64_t cause) {
+    p->ru[RU_NFAULT]++;
+    struct vma *v = vma_find(p, va);
+    if (v == NULL) {
+        return -1;
+    }
+    if ((cause == 12 && !(v->perm & PTE_X)) ||
+        (cause == 13 && !(v->perm & PTE_R)) ||
+        (cause == 15 && !(v->perm & PTE_W))) {
+        return -1;
+    }
+
+    uint64_t page = PGROUNDDOWN(va);
+    uint64_t need = cause == 12 ? PTE_X : cause == 13 ? PTE_R : PTE_W;
+    pte_t *pte = pagewalk(p->pgt, page);
+    bool replace = pte != NULL && (*pte & PTE_V);
+    if (replace && (*pte & need)) {
+        // the page is there already, this hart still had the old
+        // invalid entry, which it may cache.
+        pageflush(page, 1, ASID(p));
+        return 0;
+    }
+
+    uint64_t bits = v->perm | PTE_U;
+    uint64_t pa;
+    if (cause == 13 && _vmaanon(v, page)) {
+        // reading memory that was never written, it's all zeroes.
+        // map the shared zero page read-only, the first store faults
+        // again and gets a private page below.
+        pa = (uint64_t)getzeropage();
+        bits = (bits & ~PTE_W) | PTE_SHARED;
+    } else if (_vmashared(v, page)) {
+        // src and start agree within a page, so stepping back to the
+        // page boundary lands on a page boundary of the image too.
+        pa = (uint64_t)v->src - (v->start - page);
+        bits |= PTE_SHARED;
+    } else {
+        // a store to a page that maps the zero page ends up here as well,
+        // mapping the new page below simply replaces it.
+        uint8_t *mem = pagezalloc(1);
+        if (mem == NULL) {
+            return -1;
+        }
+        // copy whatever part of the page is backed by the image,
+        // the rest stays zero.
+        uint64_t lo = page < v->start ? v->start : page;
+        uint64_t hi = page + PGSIZE;
+        if (hi > v->start + v->filesz) {
+            hi = v->start + v->filesz;
+        }
+        if (lo < hi) {
+            memcpy(mem + (lo - page), v->src + (lo - v->start), hi - lo);
+        }
+        pa = (uint64_t)mem;
+    }
+
+    // the page replaced, if any, stops being resident.
+    int64_t rss = (pa != (uint64_t)getzeropage()) - (replace && _vmaresident(*pte));
+    pagemap(p->pgt, page, pa, bits, 0);
+    _vmarss(p, rss);
+    if (replace) {
+        // the zero page is gone, other harts that ran p may still
+        // map it.
+        tlbshootdown(p->cpumask, page, 1, ASID(p));
+    } else {
+        pageflush(page, 1, ASID(p));
+    }
+    return 0;
+}
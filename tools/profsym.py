@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Turn the kernel profiler's console dump into folded stacks.
+
+Start the profiler with ctrl-t (or the profile() syscall), stop it with
+ctrl-t again, then feed the console log to this script:
+
+    python3 tools/profsym.py console.log [kernel/kernel.sym ...] > out.folded
+
+Every line between "prof-begin" and "prof-end" is one sample,
+"prof <hart> <mode> <pc> <return address>...". Each address is resolved
+to the closest symbol below it, the stack is printed root first and
+identical stacks are counted, which is the input flamegraph.pl and
+speedscope expect. Samples taken in user mode (mode 0) are prefixed
+with "[user]", they only carry the pc.
+"""
+
+import bisect
+import collections
+import sys
+
+
+def load_syms(paths):
+    syms = []
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) != 2:
+                    continue
+                try:
+                    addr = int(parts[0], 16)
+                except ValueError:
+                    continue
+                syms.append((addr, parts[1]))
+    syms.sort()
+    return [a for a, _ in syms], [n for _, n in syms]
+
+
+def resolve(addrs, names, pc):
+    i = bisect.bisect_right(addrs, pc) - 1
+    if i < 0:
+        return hex(pc)
+    return names[i]
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    symfiles = sys.argv[2:] or ["kernel/kernel.sym"]
+    addrs, names = load_syms(symfiles)
+
+    stacks = collections.Counter()
+    inside = False
+    with open(sys.argv[1], errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line == "prof-begin":
+                inside = True
+            elif line == "prof-end":
+                inside = False
+            elif inside and line.startswith("prof "):
+                fields = line.split()
+                mode = int(fields[2])
+                frames = [resolve(addrs, names, int(pc, 16)) for pc in fields[3:]]
+                frames.reverse()
+                if mode == 0:
+                    frames.insert(0, "[user]")
+                stacks[";".join(frames)] += 1
+
+    for stack, count in sorted(stacks.items()):
+        print(stack, count)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Turn the kernel's tracepoint records into a timeline.
+
+Start tracing with ctrl-e, stop it with ctrl-e again, then feed the
+console log to this script:
+
+    python3 tools/tracedump.py console.log > timeline.txt
+
+Every line between "trace-begin" and "trace-end" is one record,
+"trace <hart> <time> <event> <a0> <a1> <a2>", all in hex. The rings
+can also be read straight out of memory instead. trace_start() prints
+where each hart's ring is and how many records it holds, save them
+from the qemu monitor with "pmemsave <addr> <records * 32> hart0.bin"
+and pass one file per hart:
+
+    python3 tools/tracedump.py --raw 0:hart0.bin 1:hart1.bin ...
+
+The records of all harts are merged by time and printed one per line,
+in microseconds since the first one. With --json, the timeline is
+written in the Chrome trace event format instead, for chrome://tracing
+or Perfetto: every hart is a thread, processes running on it are
+slices between their sched-in and sched-out.
+"""
+
+import json
+import struct
+import sys
+
+TIMEBASE = 10000000  # mtime ticks per second, see memlayout.h
+
+# enum trace_event in kernel/include/trace.h.
+EVENTS = [
+    "schedin",
+    "schedout",
+    "trap",
+    "syscall",
+    "pagealloc",
+    "pagefree",
+    "plic",
+]
+
+# enum procstate in kernel/include/proc.h.
+STATES = ["UNUSED", "SLEEPING", "RUNNABLE", "RUNNING", "ZOMBIE"]
+
+# struct tracerec.
+RECORD = struct.Struct("<QIIQQ")
+
+
+def read_log(path):
+    recs = []
+    inside = False
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line == "trace-begin":
+                inside = True
+            elif line == "trace-end":
+                inside = False
+            elif inside and line.startswith("trace "):
+                fields = line.split()
+                hart = int(fields[1])
+                time, ev, a0, a1, a2 = (int(x, 16) for x in fields[2:7])
+                recs.append((time, hart, ev, a0, a1, a2))
+    return recs
+
+
+def read_raw(specs):
+    recs = []
+    for spec in specs:
+        hart, path = spec.split(":", 1)
+        with open(path, "rb") as f:
+            data = f.read()
+        for off in range(0, len(data) - RECORD.size + 1, RECORD.size):
+            time, ev, a0, a1, a2 = RECORD.unpack_from(data, off)
+            # slots the ring hasn't got to yet are still zero.
+            if time == 0:
+                continue
+            recs.append((time, int(hart), ev, a0, a1, a2))
+    return recs
+
+
+def describe(ev, a0, a1, a2):
+    name = EVENTS[ev] if ev < len(EVENTS) else "event%d" % ev
+    if name == "schedin":
+        return name, "pid %d" % a0
+    if name == "schedout":
+        state = STATES[a1] if a1 < len(STATES) else str(a1)
+        return name, "pid %d %s" % (a0, state)
+    if name == "trap":
+        kind = "irq" if a0 & (1 << 31) else "exc"
+        return name, "%s %d epc 0x%x tval 0x%x" % (kind, a0 & 0xfff, a1, a2)
+    if name == "syscall":
+        return name, "%d pid %d arg 0x%x" % (a0, a1, a2)
+    if name == "pagealloc":
+        return name, "%d at 0x%x" % (a0, a1)
+    if name == "pagefree":
+        return name, "0x%x" % a1
+    if name == "plic":
+        return name, "irq %d" % a0
+    return name, "0x%x 0x%x 0x%x" % (a0, a1, a2)
+
+
+def usec(ticks):
+    return ticks * 1000000 / TIMEBASE
+
+
+def timeline(recs):
+    start = recs[0][0]
+    for time, hart, ev, a0, a1, a2 in recs:
+        name, args = describe(ev, a0, a1, a2)
+        print("%14.3f hart%d %-10s %s" % (usec(time - start), hart, name, args))
+
+
+def chrome(recs):
+    start = recs[0][0]
+    out = []
+    for time, hart, ev, a0, a1, a2 in recs:
+        name, args = describe(ev, a0, a1, a2)
+        ts = usec(time - start)
+        if name == "schedin":
+            out.append({"name": "pid %d" % a0, "ph": "B", "ts": ts, "pid": 0, "tid": hart})
+        elif name == "schedout":
+            out.append({"name": "pid %d" % a0, "ph": "E", "ts": ts, "pid": 0, "tid": hart})
+        else:
+            out.append({"name": name, "ph": "i", "s": "t", "ts": ts, "pid": 0, "tid": hart,
+                        "args": {"detail": args}})
+    json.dump({"traceEvents": out}, sys.stdout)
+
+
+def main():
+    args = sys.argv[1:]
+    as_json = "--json" in args
+    args = [a for a in args if a != "--json"]
+    if not args:
+        sys.exit(__doc__)
+    if args[0] == "--raw":
+        recs = read_raw(args[1:])
+    else:
+        recs = read_log(args[0])
+    if not recs:
+        sys.exit("no trace records found")
+    recs.sort(key=lambda r: (r[0], r[1]))
+
+    if as_json:
+        chrome(recs)
+    else:
+        timeline(recs)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,11 @@
+#include "user.h"
+
+// the first user program. it runs in its own address space
+// and can only reach the kernel through ecall.
+void main() {
+    while (1) {
+        make_syscall(1);
+        // give the hart away for a second instead of counting.
+        nanosleep(1000000000);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef RVOS_USER_H
+#define RVOS_USER_H
+
+#include "kernel/include/types.h"
+#include "kernel/include/rusage.h"
+
+// usys.S
+uint64_t make_syscall(uint64_t sysno);
+uint64_t nanosleep(uint64_t ns);
+uint64_t perf(uint64_t event);
+uint64_t profile(uint64_t hz);
+uint64_t getrusage(uint32_t pid, uint64_t field);
+
+#endif //RVOS_USER_H